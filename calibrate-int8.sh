@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Quantize a model for --precision int8, writes <model-name>-int8.param/.bin next to it
+# Usage: ./calibrate-int8.sh <models-dir> <model-name> <images-dir> [tile-size]
+MODELS=$1
+NAME=$2
+IMAGES=$3
+TILE=${4:-200}
+
+# ncnn2table and ncnn2int8 come with ncnn, configure with -D NCNN_BUILD_TOOLS=ON to build them
+TOOLS=${NCNN_TOOLS:-build/ncnn/tools/quantize}
+
+if [ -z "$MODELS" ] || [ -z "$NAME" ] || [ -z "$IMAGES" ]; then
+	echo "Usage: $0 <models-dir> <model-name> <images-dir> [tile-size]"
+	exit 1
+fi
+
+if [ ! -x "$TOOLS/ncnn2table" ] || [ ! -x "$TOOLS/ncnn2int8" ]; then
+	echo "ncnn2table and ncnn2int8 not found in $TOOLS, set NCNN_TOOLS"
+	exit 1
+fi
+
+LIST=$(mktemp)
+TABLE=$(mktemp)
+trap 'rm -f "$LIST" "$TABLE"' EXIT
+
+# a few dozen images like the ones to upscale are enough
+find "$IMAGES" -maxdepth 1 -type f \( -iname '*.png' -o -iname '*.jpg' -o -iname '*.jpeg' \) | sort > "$LIST"
+if [ ! -s "$LIST" ]; then
+	echo "no png or jpg images in $IMAGES"
+	exit 1
+fi
+
+# the same input as the preproc shaders, rgb scaled to 0~1 in tiles with 10 pixels of padding on each side
+"$TOOLS/ncnn2table" "$MODELS/$NAME.param" "$MODELS/$NAME.bin" "$LIST" "$TABLE" \
+	mean=[0,0,0] norm=[0.0039216,0.0039216,0.0039216] shape=[$((TILE + 20)),$((TILE + 20)),3] pixel=RGB method=kl || exit 1
+
+"$TOOLS/ncnn2int8" "$MODELS/$NAME.param" "$MODELS/$NAME.bin" "$MODELS/$NAME-int8.param" "$MODELS/$NAME-int8.bin" "$TABLE" || exit 1
+
+echo "wrote $MODELS/$NAME-int8.param and $MODELS/$NAME-int8.bin"
@@ -0,0 +1,116 @@
+#ifndef ALPHA_BOUNDS_H
+#define ALPHA_BOUNDS_H
+
+// bounding boxes of the non-transparent pixels of an rgba image, one per grid cell
+// built in one pass over the alpha plane, so sprite sheets can skip their empty tiles without rescanning the padding
+#include <algorithm>
+#include <vector>
+
+class AlphaBounds
+{
+public:
+    AlphaBounds()
+    {
+        cell = 0;
+        cols = 0;
+        rows = 0;
+        width = 0;
+        height = 0;
+    }
+
+    void build(const unsigned char *pixeldata, int w, int h, int channels, int _cell)
+    {
+        cell = _cell;
+        cols = (w + cell - 1) / cell;
+        rows = (h + cell - 1) / cell;
+        width = w;
+        height = h;
+
+        boxes.assign((size_t)cols * rows, Box());
+
+        for (int y = 0; y < h; y++)
+        {
+            const unsigned char *alpha = pixeldata + (size_t)y * w * channels + 3;
+            Box *row_boxes = &boxes[(size_t)(y / cell) * cols];
+
+            for (int ci = 0; ci < cols; ci++)
+            {
+                const int x0 = ci * cell;
+                const int x1 = std::min(x0 + cell, w);
+
+                // first and last visible pixel of this row within the cell
+                int first = x0;
+                while (first < x1 && alpha[(size_t)first * channels] == 0)
+                    first++;
+
+                if (first == x1)
+                    continue;
+
+                int last = x1 - 1;
+                while (alpha[(size_t)last * channels] == 0)
+                    last--;
+
+                Box &b = row_boxes[ci];
+                b.x0 = std::min(b.x0, first);
+                b.x1 = std::max(b.x1, last + 1);
+                b.y0 = std::min(b.y0, y);
+                b.y1 = std::max(b.y1, y + 1);
+            }
+        }
+    }
+
+    bool empty() const
+    {
+        return boxes.empty();
+    }
+
+    // whether [x0, x1) x [y0, y1), clamped to the image, may hold a visible pixel
+    // false means fully transparent, true may be a false alarm where a box spans the gap between sprites
+    bool any(int x0, int y0, int x1, int y1) const
+    {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, width);
+        y1 = std::min(y1, height);
+
+        if (x0 >= x1 || y0 >= y1)
+            return false;
+
+        for (int ri = y0 / cell; ri <= (y1 - 1) / cell; ri++)
+        {
+            for (int ci = x0 / cell; ci <= (x1 - 1) / cell; ci++)
+            {
+                const Box &b = boxes[(size_t)ri * cols + ci];
+                if (b.x0 < x1 && b.x1 > x0 && b.y0 < y1 && b.y1 > y0)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    // empty boxes never intersect anything
+    struct Box
+    {
+        Box()
+        {
+            x0 = y0 = 0x7fffffff;
+            x1 = y1 = -1;
+        }
+
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+    };
+
+    int cell;
+    int cols;
+    int rows;
+    int width;
+    int height;
+    std::vector<Box> boxes;
+};
+
+#endif // ALPHA_BOUNDS_H
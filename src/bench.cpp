@@ -0,0 +1,818 @@
+// benchmark for the whole upscaling pipeline, reports json
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// image decoder and encoder with stb
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_PSD
+#define STBI_NO_TGA
+#define STBI_NO_GIF
+#define STBI_NO_HDR
+#define STBI_NO_PIC
+#define STBI_NO_STDIO
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "webp_image.h"
+#define STB_IMAGE_RESIZE2_IMPLEMENTATION
+#include "stb_image_resize2.h"
+#include "image_resize.h"
+
+// ncnn
+#include "benchmark.h"
+#include "cpu.h"
+#include "gpu.h"
+#include "realesrgan.h"
+
+#include "frame_stream.h"
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: upscayl-bench [options]...\n\n");
+    fprintf(stderr, "  -h                   show this help\n");
+    fprintf(stderr, "  -m model-path        folder path to the pre-trained models. default=models\n");
+    fprintf(stderr, "  -n model-name        model name (default=realesr-animevideov3-x4)\n");
+    fprintf(stderr, "  -i image             real image to benchmark (jpg/png/webp), can be given more than once\n");
+    fprintf(stderr, "  -W width             synthetic image width (default=256, 0=no synthetic image)\n");
+    fprintf(stderr, "  -H height            synthetic image height (default=256)\n");
+    fprintf(stderr, "  -c channels          synthetic image channels (default=3,4)\n");
+    fprintf(stderr, "  -t tile-size         tile sizes to try (default=64,128,200)\n");
+    fprintf(stderr, "  -x                   also run with tta mode\n");
+    fprintf(stderr, "  -y                   also run 3 channel images as yuv420 frames, converted in the shaders\n");
+    fprintf(stderr, "  -a                   also run 4 channel images with alpha through the model, reports the overhead over bicubic\n");
+    fprintf(stderr, "  -u                   skip inference for uniform and fully transparent tiles like upscayl-bin does, flat areas then run faster than the model\n");
+    fprintf(stderr, "  -S                   also run every image with the scalar pre/post shaders instead of the vec4 ones\n");
+    fprintf(stderr, "  -p precisions        precisions to try, fp32,fp16s,fp16a,int8 (default=fp16s), reports psnr and ssim against fp32\n");
+    fprintf(stderr, "  -s output-scale      output scale for the resize stage (default=0.5 of the model scale)\n");
+    fprintf(stderr, "  -g gpu-id            gpu device to use (-1=cpu, default=auto)\n");
+    fprintf(stderr, "  -l loop-count        runs per case (default=8)\n");
+    fprintf(stderr, "  -o output-path       json output path (default=stdout)\n");
+}
+
+static std::vector<int> parse_int_array(const char *arg)
+{
+    std::vector<int> array;
+    array.push_back(atoi(arg));
+
+    const char *p = strchr(arg, ',');
+    while (p)
+    {
+        p++;
+        array.push_back(atoi(p));
+        p = strchr(p, ',');
+    }
+
+    return array;
+}
+
+// fp32, fp16s, fp16a or int8 separated by commas, empty on any unknown name
+static std::vector<int> parse_precision_array(const char *arg)
+{
+    std::vector<int> array;
+
+    std::string list = arg;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+
+        const int precision = parse_precision(list.substr(start, end - start).c_str());
+        if (precision == -1)
+            return std::vector<int>();
+
+        array.push_back(precision);
+        start = end + 1;
+    }
+
+    return array;
+}
+
+class BenchImage
+{
+public:
+    std::string name;
+    std::vector<unsigned char> filedata; // empty for synthetic images
+    std::vector<unsigned char> pixeldata;
+    int w;
+    int h;
+    int c;
+    bool yuv420; // pixeldata is planar yuv420
+    bool alpha_net; // alpha goes through the model instead of bicubic
+    bool scalar; // scalar pre/post shaders even where the vec4 ones fit
+};
+
+// gradients with some deterministic noise, flat images would flatter the network
+static void make_synthetic_image(BenchImage &image, int w, int h, int c)
+{
+    char name[64];
+    sprintf(name, "synthetic-%dx%d-c%d", w, h, c);
+
+    image.name = name;
+    image.w = w;
+    image.h = h;
+    image.c = c;
+    image.yuv420 = false;
+    image.alpha_net = false;
+    image.scalar = false;
+    image.pixeldata.resize((size_t)w * h * c);
+
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            unsigned char *p = &image.pixeldata[((size_t)y * w + x) * c];
+
+            const unsigned int noise = ((unsigned int)(y * w + x) * 2654435761u) >> 27;
+
+            p[0] = (unsigned char)(x * 255 / std::max(w - 1, 1) / 2 + noise);
+            p[1] = (unsigned char)(y * 255 / std::max(h - 1, 1) / 2 + noise);
+            p[2] = (unsigned char)(((x / 16 + y / 16) % 2) * 128 + noise);
+            if (c == 4)
+                p[3] = (unsigned char)((x + y) * 255 / std::max(w + h - 2, 1));
+        }
+    }
+}
+
+static unsigned char *decode_image(const unsigned char *filedata, int length, int *w, int *h, int *c)
+{
+    unsigned char *pixeldata = webp_load(filedata, length, w, h, c);
+    if (pixeldata)
+        return pixeldata;
+
+    pixeldata = stbi_load_from_memory(filedata, length, w, h, c, 0);
+    if (pixeldata && (*c == 1 || *c == 2))
+    {
+        // grayscale -> rgb / rgba, same as upscayl-bin
+        stbi_image_free(pixeldata);
+        const int desired_channels = *c + 2;
+        pixeldata = stbi_load_from_memory(filedata, length, w, h, c, desired_channels);
+        *c = desired_channels;
+    }
+
+    return pixeldata;
+}
+
+static void free_image(unsigned char *pixeldata)
+{
+    // webp_load and stbi_load both use malloc
+    free(pixeldata);
+}
+
+static bool load_image(BenchImage &image, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    const long length = ftell(fp);
+    rewind(fp);
+
+    image.filedata.resize(length);
+    const bool ok = length > 0 && fread(image.filedata.data(), 1, length, fp) == (size_t)length;
+    fclose(fp);
+
+    if (!ok)
+        return false;
+
+    unsigned char *pixeldata = decode_image(image.filedata.data(), (int)length, &image.w, &image.h, &image.c);
+    if (!pixeldata)
+        return false;
+
+    image.name = path;
+    image.yuv420 = false;
+    image.alpha_net = false;
+    image.scalar = false;
+    image.pixeldata.assign(pixeldata, pixeldata + (size_t)image.w * image.h * image.c);
+    free_image(pixeldata);
+
+    return true;
+}
+
+// bt.601 luma of interleaved rgb or rgba pixels
+static std::vector<float> luma_plane(const unsigned char *pixeldata, int w, int h, int c)
+{
+    std::vector<float> luma((size_t)w * h);
+    for (size_t i = 0; i < luma.size(); i++)
+    {
+        const unsigned char *p = pixeldata + i * c;
+        luma[i] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+    }
+
+    return luma;
+}
+
+// over every byte, identical outputs report 100
+static double psnr(const unsigned char *a, const unsigned char *b, size_t size)
+{
+    double sse = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        const double d = (double)a[i] - b[i];
+        sse += d * d;
+    }
+
+    if (sse == 0)
+        return 100;
+
+    return std::min(10 * log10(255.0 * 255.0 * size / sse), 100.0);
+}
+
+// mean ssim of the luma over 8x8 windows at a stride of 4
+static double ssim(const unsigned char *a, const unsigned char *b, int w, int h, int c)
+{
+    const std::vector<float> la = luma_plane(a, w, h, c);
+    const std::vector<float> lb = luma_plane(b, w, h, c);
+
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+
+    double sum = 0;
+    int count = 0;
+    for (int y = 0; y + 8 <= h; y += 4)
+    {
+        for (int x = 0; x + 8 <= w; x += 4)
+        {
+            double sa = 0;
+            double sb = 0;
+            double saa = 0;
+            double sbb = 0;
+            double sab = 0;
+            for (int j = 0; j < 8; j++)
+            {
+                for (int i = 0; i < 8; i++)
+                {
+                    const double va = la[(size_t)(y + j) * w + x + i];
+                    const double vb = lb[(size_t)(y + j) * w + x + i];
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                }
+            }
+
+            const double ma = sa / 64;
+            const double mb = sb / 64;
+            const double va = saa / 64 - ma * ma;
+            const double vb = sbb / 64 - mb * mb;
+            const double cov = sab / 64 - ma * mb;
+
+            sum += (2 * ma * mb + c1) * (2 * cov + c2) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+            count++;
+        }
+    }
+
+    return count > 0 ? sum / count : 1;
+}
+
+static void count_bytes(void *context, void * /*data*/, int size)
+{
+    *(size_t *)context += size;
+}
+
+// per stage samples of one case, in milliseconds
+class StageSamples
+{
+public:
+    const char *name;
+    std::vector<double> samples;
+};
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    // nearest rank
+    const size_t rank = (size_t)std::max(0.0, std::min((double)sorted.size() - 1, p / 100 * sorted.size() + 0.5 - 1));
+    return sorted[rank];
+}
+
+static void write_stats(FILE *fp, const std::vector<double> &samples)
+{
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    double mean = 0;
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        mean += sorted[i];
+    }
+    mean /= sorted.size();
+
+    fprintf(fp, "{\"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f}",
+            sorted.front(), percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99), sorted.back(), mean);
+}
+
+static void write_json_string(FILE *fp, const std::string &str)
+{
+    fputc('"', fp);
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        const char ch = str[i];
+        if (ch == '"' || ch == '\\')
+            fprintf(fp, "\\%c", ch);
+        else if ((unsigned char)ch < 0x20)
+            fprintf(fp, "\\u%04x", ch);
+        else
+            fputc(ch, fp);
+    }
+    fputc('"', fp);
+}
+
+// loaded with the scale probed, 0 when the model does not run
+static RealESRGAN *create_realesrgan(int gpuid, int tta_mode, int precision, bool skip_uniform, const std::string &model, const std::string &modelname)
+{
+    // int8 models are written by calibrate-int8.sh next to the float ones
+    const std::string suffix = precision == PRECISION_INT8 ? "-int8" : "";
+    const std::string parampath = model + "/" + modelname + suffix + ".param";
+    const std::string modelpath = model + "/" + modelname + suffix + ".bin";
+
+    RealESRGAN *realesrgan = new RealESRGAN(gpuid, tta_mode);
+    realesrgan->precision = precision;
+    realesrgan->skip_uniform = skip_uniform;
+    realesrgan->skip_transparent = skip_uniform;
+
+#if _WIN32
+    realesrgan->load(std::wstring(parampath.begin(), parampath.end()), std::wstring(modelpath.begin(), modelpath.end()));
+#else
+    realesrgan->load(parampath, modelpath);
+#endif
+
+    realesrgan->scale = realesrgan->native_scale;
+    realesrgan->prepadding = 10;
+
+    if (realesrgan->scale == 0)
+    {
+        fprintf(stderr, "🚨 Error: Failed to run %s\n", parampath.c_str());
+        delete realesrgan;
+        return 0;
+    }
+
+    return realesrgan;
+}
+
+int main(int argc, char **argv)
+{
+    std::string model = "models";
+    std::string modelname = "realesr-animevideov3-x4";
+    std::vector<std::string> imagepaths;
+    int synthetic_w = 256;
+    int synthetic_h = 256;
+    std::vector<int> channels_list(1, 3);
+    channels_list.push_back(4);
+    std::vector<int> tilesizes;
+    tilesizes.push_back(64);
+    tilesizes.push_back(128);
+    tilesizes.push_back(200);
+    int with_tta = 0;
+    int with_yuv420 = 0;
+    int with_alpha_net = 0;
+    int with_scalar = 0;
+    int skip_uniform = 0;
+    std::vector<int> precisions(1, PRECISION_FP16_STORAGE);
+    int with_quality = 0;
+    float output_scale = 0.f;
+    int gpuid = -2;
+    int loop_count = 8;
+    std::string outputpath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-h") == 0)
+        {
+            print_usage();
+            return 0;
+        }
+        if (strcmp(arg, "-x") == 0)
+        {
+            with_tta = 1;
+            continue;
+        }
+        if (strcmp(arg, "-y") == 0)
+        {
+            with_yuv420 = 1;
+            continue;
+        }
+        if (strcmp(arg, "-a") == 0)
+        {
+            with_alpha_net = 1;
+            continue;
+        }
+        if (strcmp(arg, "-S") == 0)
+        {
+            with_scalar = 1;
+            continue;
+        }
+        if (strcmp(arg, "-u") == 0)
+        {
+            skip_uniform = 1;
+            continue;
+        }
+        if (arg[0] != '-' || strlen(arg) != 2 || !value)
+        {
+            print_usage();
+            return -1;
+        }
+
+        switch (arg[1])
+        {
+        case 'm':
+            model = value;
+            break;
+        case 'n':
+            modelname = value;
+            break;
+        case 'i':
+            imagepaths.push_back(value);
+            break;
+        case 'W':
+            synthetic_w = atoi(value);
+            break;
+        case 'H':
+            synthetic_h = atoi(value);
+            break;
+        case 'c':
+            channels_list = parse_int_array(value);
+            break;
+        case 't':
+            tilesizes = parse_int_array(value);
+            break;
+        case 'p':
+            precisions = parse_precision_array(value);
+            if (precisions.empty())
+            {
+                fprintf(stderr, "🚨 Error: Invalid precision, expected fp32, fp16s, fp16a or int8!\n");
+                return -1;
+            }
+            with_quality = 1;
+            break;
+        case 's':
+            output_scale = (float)atof(value);
+            break;
+        case 'g':
+            gpuid = atoi(value);
+            break;
+        case 'l':
+            loop_count = std::max(atoi(value), 1);
+            break;
+        case 'o':
+            outputpath = value;
+            break;
+        default:
+            print_usage();
+            return -1;
+        }
+        i++;
+    }
+
+    std::vector<BenchImage> images;
+    for (size_t i = 0; i < imagepaths.size(); i++)
+    {
+        BenchImage image;
+        if (!load_image(image, imagepaths[i].c_str()))
+        {
+            fprintf(stderr, "🚨 Error: Failed to load %s\n", imagepaths[i].c_str());
+            return -1;
+        }
+        images.push_back(image);
+    }
+    if (synthetic_w > 0 && synthetic_h > 0)
+    {
+        for (size_t i = 0; i < channels_list.size(); i++)
+        {
+            if (channels_list[i] != 3 && channels_list[i] != 4)
+                continue;
+
+            BenchImage image;
+            make_synthetic_image(image, synthetic_w, synthetic_h, channels_list[i]);
+            images.push_back(image);
+        }
+    }
+
+    if (with_yuv420)
+    {
+        const size_t count = images.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (images[i].c != 3 || images[i].w % 2 != 0 || images[i].h % 2 != 0)
+                continue;
+
+            BenchImage image = images[i];
+            image.name += "-yuv420";
+            image.filedata.clear();
+            image.yuv420 = true;
+            image.pixeldata.resize((size_t)image.w * image.h * 3 / 2);
+            rgb_to_yuv420(images[i].pixeldata.data(), image.w, image.h, 3, false, image.pixeldata.data());
+            images.push_back(image);
+        }
+    }
+
+    if (with_alpha_net)
+    {
+        const size_t count = images.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (images[i].c != 4)
+                continue;
+
+            BenchImage image = images[i];
+            image.name += "-alphanet";
+            image.alpha_net = true;
+            images.push_back(image);
+        }
+    }
+
+    if (with_scalar)
+    {
+        const size_t count = images.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (images[i].yuv420)
+                continue;
+
+            BenchImage image = images[i];
+            image.name += "-scalar";
+            image.scalar = true;
+            images.push_back(image);
+        }
+    }
+
+    if (images.empty())
+    {
+        print_usage();
+        return -1;
+    }
+
+    ncnn::create_gpu_instance();
+
+    // no vulkan device, or a software one when VK_ICD_FILENAMES points at lavapipe / swiftshader
+    if (gpuid == -2)
+    {
+        gpuid = ncnn::get_gpu_count() > 0 ? ncnn::get_default_gpu_index() : -1;
+    }
+    if (gpuid < -1 || gpuid >= ncnn::get_gpu_count())
+    {
+        fprintf(stderr, "🚨 Error: Invalid GPU Device\n");
+
+        ncnn::destroy_gpu_instance();
+        return -1;
+    }
+
+    const std::string device = gpuid == -1 ? std::string("cpu") : std::string(ncnn::get_gpu_info(gpuid).device_name());
+
+    FILE *out = outputpath.empty() ? stdout : fopen(outputpath.c_str(), "wb");
+    if (!out)
+    {
+        fprintf(stderr, "🚨 Error: Failed to open %s\n", outputpath.c_str());
+
+        ncnn::destroy_gpu_instance();
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"model\": ");
+    write_json_string(out, modelname);
+    fprintf(out, ",\n  \"device\": ");
+    write_json_string(out, device);
+    fprintf(out, ",\n  \"cpu_count\": %d,\n  \"loop_count\": %d,\n  \"skip_uniform\": %s,\n  \"runs\": [", ncnn::get_cpu_count(), loop_count, skip_uniform ? "true" : "false");
+
+    bool first_run = true;
+    int ret = 0;
+
+    for (int tta_mode = 0; tta_mode <= with_tta && ret == 0; tta_mode++)
+    {
+        // fp32 output of every case, the reference for psnr and ssim
+        RealESRGAN *reference = 0;
+        if (with_quality)
+        {
+            reference = create_realesrgan(gpuid, tta_mode, PRECISION_FP32, false, model, modelname);
+            if (!reference)
+            {
+                ret = -1;
+                break;
+            }
+        }
+
+        for (size_t pi = 0; pi < precisions.size() && ret == 0; pi++)
+        {
+            const int precision = precisions[pi];
+
+            RealESRGAN *realesrgan = create_realesrgan(gpuid, tta_mode, precision, skip_uniform != 0, model, modelname);
+            if (!realesrgan)
+            {
+                ret = -1;
+                break;
+            }
+
+            const int scale = realesrgan->scale;
+            const float resize_scale = output_scale > 0.f ? output_scale : scale * 0.5f;
+
+            for (size_t ii = 0; ii < images.size(); ii++)
+            {
+                const BenchImage &image = images[ii];
+                const int w = image.w;
+                const int h = image.h;
+                const int c = image.c;
+
+                const int resizew = std::max((int)(w * resize_scale + 0.5f), 1);
+                const int resizeh = std::max((int)(h * resize_scale + 0.5f), 1);
+
+                if (image.yuv420 && !realesrgan->support_yuv420())
+                {
+                    fprintf(stderr, "%s skipped, no yuv420 path with tta=%d on this device\n", image.name.c_str(), tta_mode);
+                    continue;
+                }
+                realesrgan->yuv420 = image.yuv420;
+                realesrgan->alpha_net = image.alpha_net;
+
+                // tta has no vec4 shaders, the scalar run would repeat the default one
+                if (image.scalar && tta_mode)
+                    continue;
+                realesrgan->vec4_shaders = !image.scalar;
+
+                for (size_t ti = 0; ti < tilesizes.size(); ti++)
+                {
+                    realesrgan->tilesize = tilesizes[ti];
+
+                    fprintf(stderr, "%s tile=%d tta=%d precision=%s\n", image.name.c_str(), tilesizes[ti], tta_mode, precision_name(precision));
+
+                    ncnn::Mat inimage = ncnn::Mat(w, h, (void *)image.pixeldata.data(), (size_t)c, c);
+                    ncnn::Mat outimage = ncnn::Mat(w * scale, h * scale, (size_t)c, c);
+
+                    // planar frames are half the bytes of rgb24, the output buffer is simply oversized
+                    if (image.yuv420)
+                    {
+                        inimage = ncnn::Mat(w, h, (void *)image.pixeldata.data(), (size_t)1u, 1);
+                        outimage = ncnn::Mat(w * scale, h * scale, (size_t)c, 1);
+                    }
+
+                    // warm up, pipelines and allocators are created lazily
+                    realesrgan->process(inimage, outimage);
+
+                    // end to end throughput, without the per stage waits
+                    std::vector<double> total;
+                    for (int i = 0; i < loop_count; i++)
+                    {
+                        const double start = ncnn::get_current_time();
+                        realesrgan->process(inimage, outimage);
+                        total.push_back(ncnn::get_current_time() - start);
+                    }
+
+                    // the same loop with bicubic alpha, the alpha tiles share the submissions so stages can not split them
+                    std::vector<double> bicubic_total;
+                    if (image.alpha_net)
+                    {
+                        realesrgan->alpha_net = false;
+                        for (int i = 0; i < loop_count; i++)
+                        {
+                            const double start = ncnn::get_current_time();
+                            realesrgan->process(inimage, outimage);
+                            bicubic_total.push_back(ncnn::get_current_time() - start);
+                        }
+                        realesrgan->alpha_net = true;
+                    }
+
+                    StageSamples stages[] = {
+                        {"decode", std::vector<double>()},
+                        {"upload", std::vector<double>()},
+                        {"preproc", std::vector<double>()},
+                        {"inference", std::vector<double>()},
+                        {"postproc", std::vector<double>()},
+                        {"download", std::vector<double>()},
+                        {"resize", std::vector<double>()},
+                        {"encode", std::vector<double>()},
+                    };
+
+                    std::vector<unsigned char> resized((size_t)resizew * resizeh * c);
+                    size_t encoded_size = 0;
+
+                    // the shaders of the last staged run, unaligned tiles and bands fall back to the scalar ones
+                    ProcessStats shader_stats;
+
+                    for (int i = 0; i < loop_count; i++)
+                    {
+                        if (!image.filedata.empty())
+                        {
+                            int dw;
+                            int dh;
+                            int dc;
+                            double start = ncnn::get_current_time();
+                            unsigned char *pixeldata = decode_image(image.filedata.data(), (int)image.filedata.size(), &dw, &dh, &dc);
+                            stages[0].samples.push_back(ncnn::get_current_time() - start);
+                            free_image(pixeldata);
+                        }
+
+                        ProcessStats stats;
+                        realesrgan->process(inimage, outimage, &stats);
+
+                        stages[1].samples.push_back(stats.upload);
+                        stages[2].samples.push_back(stats.preproc);
+                        stages[3].samples.push_back(stats.inference);
+                        stages[4].samples.push_back(stats.postproc);
+                        stages[5].samples.push_back(stats.download);
+
+                        shader_stats = stats;
+
+                        // the resize and encode stages only take interleaved pixels
+                        if (image.yuv420)
+                            continue;
+
+                        double start = ncnn::get_current_time();
+                        resize_image((const unsigned char *)outimage.data, outimage.w, outimage.h, resized.data(), resizew, resizeh, c, STBIR_FILTER_DEFAULT, ncnn::get_cpu_count());
+                        stages[6].samples.push_back(ncnn::get_current_time() - start);
+
+                        encoded_size = 0;
+                        start = ncnn::get_current_time();
+                        stbi_write_png_to_func(count_bytes, &encoded_size, outimage.w, outimage.h, c, outimage.data, 0);
+                        stages[7].samples.push_back(ncnn::get_current_time() - start);
+                    }
+
+                    // the last output against the fp32 one of the same case, planar frames have no fp32 path
+                    double quality_psnr = 0;
+                    double quality_ssim = 0;
+                    const bool quality = reference && precision != PRECISION_FP32 && !image.yuv420;
+                    if (quality)
+                    {
+                        reference->tilesize = tilesizes[ti];
+                        reference->alpha_net = image.alpha_net;
+
+                        ncnn::Mat refimage = ncnn::Mat(w * scale, h * scale, (size_t)c, c);
+                        reference->process(inimage, refimage);
+
+                        quality_psnr = psnr((const unsigned char *)outimage.data, (const unsigned char *)refimage.data, (size_t)outimage.w * outimage.h * c);
+                        quality_ssim = ssim((const unsigned char *)outimage.data, (const unsigned char *)refimage.data, outimage.w, outimage.h, c);
+                    }
+
+                    std::vector<double> sorted_total = total;
+                    std::sort(sorted_total.begin(), sorted_total.end());
+                    const double median = percentile(sorted_total, 50);
+
+                    fprintf(out, "%s\n    {\n      \"image\": ", first_run ? "" : ",");
+                    write_json_string(out, image.name);
+                    fprintf(out, ",\n      \"width\": %d,\n      \"height\": %d,\n      \"channels\": %d,\n      \"yuv420\": %s,\n", w, h, c, image.yuv420 ? "true" : "false");
+                    fprintf(out, "      \"scale\": %d,\n      \"tilesize\": %d,\n      \"tta\": %s,\n", scale, tilesizes[ti], tta_mode ? "true" : "false");
+                    const bool vec4_ran = shader_stats.tiles > 0 && shader_stats.vec4_preproc_tiles == shader_stats.tiles && shader_stats.vec4_postproc_tiles == shader_stats.tiles;
+                    fprintf(out, "      \"alpha_net\": %s,\n      \"vec4_shaders\": %s,\n", image.alpha_net ? "true" : "false", vec4_ran ? "true" : "false");
+                    fprintf(out, "      \"tiles\": %d,\n      \"vec4_preproc_tiles\": %d,\n      \"vec4_postproc_tiles\": %d,\n", shader_stats.tiles, shader_stats.vec4_preproc_tiles, shader_stats.vec4_postproc_tiles);
+                    fprintf(out, "      \"precision\": \"%s\",\n", precision_name(precision));
+                    if (quality)
+                    {
+                        fprintf(out, "      \"psnr_db\": %.3f,\n      \"ssim\": %.5f,\n", quality_psnr, quality_ssim);
+                        fprintf(stderr, "%s tile=%d tta=%d %s against fp32 psnr %.2f dB ssim %.4f\n", image.name.c_str(), tilesizes[ti], tta_mode, precision_name(precision), quality_psnr, quality_ssim);
+                    }
+                    if (image.alpha_net)
+                    {
+                        std::sort(bicubic_total.begin(), bicubic_total.end());
+                        const double bicubic_median = percentile(bicubic_total, 50);
+                        const double overhead = (median - bicubic_median) / bicubic_median * 100;
+
+                        fprintf(out, "      \"alpha_net_overhead_pct\": %.2f,\n", overhead);
+                        fprintf(stderr, "%s tile=%d tta=%d alpha through the model %+.1f%% over bicubic\n", image.name.c_str(), tilesizes[ti], tta_mode, overhead);
+                    }
+                    fprintf(out, "      \"input_mpix_per_sec\": %.4f,\n", (double)w * h / 1000000 / median * 1000);
+                    fprintf(out, "      \"output_mpix_per_sec\": %.4f,\n", (double)w * scale * h * scale / 1000000 / median * 1000);
+                    fprintf(out, "      \"encoded_png_bytes\": %zu,\n", encoded_size);
+                    fprintf(out, "      \"process_ms\": ");
+                    write_stats(out, total);
+                    fprintf(out, ",\n      \"stages_ms\": {");
+
+                    bool first_stage = true;
+                    for (size_t si = 0; si < sizeof(stages) / sizeof(stages[0]); si++)
+                    {
+                        if (stages[si].samples.empty())
+                            continue;
+
+                        fprintf(out, "%s\n        \"%s\": ", first_stage ? "" : ",", stages[si].name);
+                        write_stats(out, stages[si].samples);
+                        first_stage = false;
+                    }
+
+                    fprintf(out, "\n      }\n    }");
+                    fflush(out);
+                    first_run = false;
+                }
+            }
+
+            delete realesrgan;
+        }
+
+        delete reference;
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+
+    ncnn::destroy_gpu_instance();
+
+    return ret;
+}
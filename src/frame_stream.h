@@ -0,0 +1,436 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+// raw video frames over pipes for --raw, no codec involved
+// ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH, or -f yuv4mpegpipe -pix_fmt yuv420p, on both ends, - is stdin or stdout
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// ncnn
+#include "mat.h"
+#include "platform.h"
+
+#if _WIN32
+typedef std::wstring stream_path_t;
+#else
+typedef std::string stream_path_t;
+#endif
+
+static FILE *open_stream(const stream_path_t &path, bool write)
+{
+#if _WIN32
+    if (path == L"-")
+    {
+        FILE *fp = write ? stdout : stdin;
+        _setmode(_fileno(fp), _O_BINARY);
+        return fp;
+    }
+    return _wfopen(path.c_str(), write ? L"wb" : L"rb");
+#else
+    if (path == "-")
+        return write ? stdout : stdin;
+    return fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+}
+
+// parses WxH, WxH:rgb24 / WxH:rgba, or y4m where the stream header has the size
+static bool parse_raw_format(const char *str, int *w, int *h, int *c, int *y4m)
+{
+    *y4m = strcmp(str, "y4m") == 0;
+    if (*y4m)
+    {
+        *w = 0;
+        *h = 0;
+        *c = 3;
+        return true;
+    }
+
+    char pix_fmt[16] = "rgb24";
+    const int n = sscanf(str, "%dx%d:%15s", w, h, pix_fmt);
+    if (n < 2 || *w <= 0 || *h <= 0)
+        return false;
+
+    if (strcmp(pix_fmt, "rgb24") == 0)
+        *c = 3;
+    else if (strcmp(pix_fmt, "rgba") == 0)
+        *c = 4;
+    else
+        return false;
+
+    return true;
+}
+
+// bt.601, limited range unless the y4m header says XCOLORRANGE=FULL, same math as realesrgan_preproc_yuv420.comp
+static void yuv420_to_rgb(const unsigned char *yuv, int w, int h, bool full_range, unsigned char *rgb)
+{
+    const unsigned char *u_plane = yuv + (size_t)w * h;
+    const unsigned char *v_plane = u_plane + (size_t)(w / 2) * (h / 2);
+
+    const float luma_scale = full_range ? 1.f : 255.f / 219.f;
+    const float luma_offset = full_range ? 0.f : 16.f;
+    const float chroma_scale = full_range ? 1.f : 255.f / 224.f;
+
+#pragma omp parallel for
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            const float Y = (yuv[(size_t)y * w + x] - luma_offset) * luma_scale;
+            const float cb = (u_plane[(size_t)(y / 2) * (w / 2) + x / 2] - 128.f) * chroma_scale;
+            const float cr = (v_plane[(size_t)(y / 2) * (w / 2) + x / 2] - 128.f) * chroma_scale;
+
+            const float r = Y + 1.402f * cr;
+            const float g = Y - 0.344136f * cb - 0.714136f * cr;
+            const float b = Y + 1.772f * cb;
+
+            unsigned char *p = rgb + ((size_t)y * w + x) * 3;
+            p[0] = (unsigned char)std::min(std::max(r + 0.5f, 0.f), 255.f);
+            p[1] = (unsigned char)std::min(std::max(g + 0.5f, 0.f), 255.f);
+            p[2] = (unsigned char)std::min(std::max(b + 0.5f, 0.f), 255.f);
+        }
+    }
+}
+
+// chroma is taken from the average of each 2x2 block, same math as realesrgan_postproc_yuv420.comp
+static void rgb_to_yuv420(const unsigned char *rgb, int w, int h, int c, bool full_range, unsigned char *yuv)
+{
+    unsigned char *u_plane = yuv + (size_t)w * h;
+    unsigned char *v_plane = u_plane + (size_t)(w / 2) * (h / 2);
+
+    const float luma_scale = full_range ? 1.f : 219.f / 255.f;
+    const float luma_offset = full_range ? 0.f : 16.f;
+    const float chroma_scale = full_range ? 1.f : 224.f / 255.f;
+
+#pragma omp parallel for
+    for (int by = 0; by < h / 2; by++)
+    {
+        for (int bx = 0; bx < w / 2; bx++)
+        {
+            float sum[3] = {0.f, 0.f, 0.f};
+            for (int dy = 0; dy < 2; dy++)
+            {
+                for (int dx = 0; dx < 2; dx++)
+                {
+                    const size_t i = (size_t)(by * 2 + dy) * w + bx * 2 + dx;
+                    const unsigned char *p = rgb + i * c;
+
+                    const float Y = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+                    yuv[i] = (unsigned char)std::min(Y * luma_scale + luma_offset + 0.5f, 255.f);
+
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                }
+            }
+
+            const float r = sum[0] * 0.25f;
+            const float g = sum[1] * 0.25f;
+            const float b = sum[2] * 0.25f;
+            const float Y = 0.299f * r + 0.587f * g + 0.114f * b;
+            const float cb = (b - Y) / 1.772f * chroma_scale + 128.f;
+            const float cr = (r - Y) / 1.402f * chroma_scale + 128.f;
+
+            u_plane[(size_t)by * (w / 2) + bx] = (unsigned char)std::min(std::max(cb + 0.5f, 0.f), 255.f);
+            v_plane[(size_t)by * (w / 2) + bx] = (unsigned char)std::min(std::max(cr + 0.5f, 0.f), 255.f);
+        }
+    }
+}
+
+// reads up to the next newline, which ends y4m headers
+static bool read_line(FILE *fp, std::string &line)
+{
+    line.clear();
+    for (;;)
+    {
+        const int ch = fgetc(fp);
+        if (ch == EOF)
+            return false;
+        if (ch == '\n')
+            return true;
+        if (line.size() >= 4096)
+            return false;
+        line += (char)ch;
+    }
+}
+
+class FrameReader
+{
+public:
+    FrameReader()
+    {
+        w = 0;
+        h = 0;
+        c = 0;
+        y4m = false;
+        full_range = false;
+        fp = 0;
+    }
+
+    ~FrameReader()
+    {
+        close();
+    }
+
+    int open(const stream_path_t &path, int _w, int _h, int _c)
+    {
+        w = _w;
+        h = _h;
+        c = _c;
+        fp = open_stream(path, false);
+        return fp ? 0 : -1;
+    }
+
+    // frame size and color range come from the stream header, only 8 bit 4:2:0 is supported
+    int open_y4m(const stream_path_t &path)
+    {
+        y4m = true;
+        c = 3;
+
+        fp = open_stream(path, false);
+        if (!fp)
+            return -1;
+
+        std::string header;
+        if (!read_line(fp, header) || header.compare(0, 10, "YUV4MPEG2 ") != 0)
+        {
+            fprintf(stderr, "🚨 Error: Not a YUV4MPEG2 stream\n");
+            return -1;
+        }
+
+        // everything besides the size is passed through to the output header
+        size_t pos = 10;
+        while (pos < header.size())
+        {
+            size_t end = header.find(' ', pos);
+            if (end == std::string::npos)
+                end = header.size();
+            const std::string token = header.substr(pos, end - pos);
+            pos = end + 1;
+
+            if (token.empty())
+                continue;
+
+            if (token[0] == 'W')
+            {
+                w = atoi(token.c_str() + 1);
+                continue;
+            }
+            if (token[0] == 'H')
+            {
+                h = atoi(token.c_str() + 1);
+                continue;
+            }
+            if (token[0] == 'C' && token.compare(0, 4, "C420") != 0)
+            {
+                fprintf(stderr, "🚨 Error: Unsupported y4m colorspace %s, only 8 bit 4:2:0 is supported\n", token.c_str());
+                return -1;
+            }
+            if (token[0] == 'C' && token.size() > 4 && token[4] == 'p' && token != "C420paldv")
+            {
+                // C420p10 and friends
+                fprintf(stderr, "🚨 Error: Unsupported y4m colorspace %s, only 8 bit 4:2:0 is supported\n", token.c_str());
+                return -1;
+            }
+            if (token == "XCOLORRANGE=FULL")
+            {
+                full_range = true;
+            }
+
+            params += " " + token;
+        }
+
+        if (w <= 0 || h <= 0 || w % 2 != 0 || h % 2 != 0)
+        {
+            fprintf(stderr, "🚨 Error: Invalid y4m frame size %dx%d, both have to be even\n", w, h);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    void close()
+    {
+        if (fp && fp != stdin)
+            fclose(fp);
+        fp = 0;
+    }
+
+    size_t frame_size() const
+    {
+        return y4m ? (size_t)w * h * 3 / 2 : (size_t)w * h * c;
+    }
+
+    // false at the end of the stream, a truncated last frame is dropped
+    bool read(unsigned char *data)
+    {
+        if (y4m)
+        {
+            std::string line;
+            if (!read_line(fp, line))
+                return false;
+
+            if (line.compare(0, 5, "FRAME") != 0)
+            {
+                fprintf(stderr, "⚠️ Warning: Invalid y4m frame header, stopping here\n");
+                return false;
+            }
+        }
+
+        const size_t size = frame_size();
+        const size_t n = fread(data, 1, size, fp);
+        if (n != 0 && n != size)
+        {
+            fprintf(stderr, "⚠️ Warning: Dropping a truncated frame of %d bytes at the end of the stream\n", (int)n);
+        }
+        return n == size;
+    }
+
+    int w;
+    int h;
+    int c; // 3 for y4m, frames are planar yuv420 though
+
+    bool y4m;
+    bool full_range;
+    std::string params; // y4m header fields besides the size, with a leading space
+
+private:
+    FILE *fp;
+};
+
+class FrameWriter
+{
+public:
+    FrameWriter()
+    {
+        y4m = false;
+        full_range = false;
+        fp = 0;
+        next = 0;
+        ok = true;
+        header_written = false;
+    }
+
+    ~FrameWriter()
+    {
+        close();
+    }
+
+    int open(const stream_path_t &path)
+    {
+        fp = open_stream(path, true);
+        return fp ? 0 : -1;
+    }
+
+    void close()
+    {
+        if (fp && fp != stdout)
+            fclose(fp);
+        fp = 0;
+    }
+
+    // planar yuv420 when elempack is 1, interleaved rgb(a) otherwise
+    static size_t frame_bytes(const ncnn::Mat &image)
+    {
+        if (image.elempack == 1)
+            return (size_t)image.w * image.h * 3 / 2;
+        return (size_t)image.w * image.h * image.elemsize;
+    }
+
+    // frames come from several save threads in any order and go out in id order
+    // a malloced image is owned by the writer from now on, ncnn allocated ones are refcounted
+    bool write(int id, const ncnn::Mat &image, bool malloced)
+    {
+        lock.lock();
+
+        Pending p;
+        p.image = image;
+        p.malloced = malloced;
+        pending[id] = p;
+
+        for (;;)
+        {
+            std::map<int, Pending>::iterator it = pending.find(next);
+            if (it == pending.end())
+                break;
+
+            const ncnn::Mat &m = it->second.image;
+            if (ok)
+            {
+                ok = write_frame(m);
+            }
+
+            if (it->second.malloced)
+                free(m.data);
+            pending.erase(it);
+
+            next++;
+        }
+
+        const bool result = ok;
+
+        lock.unlock();
+
+        return result;
+    }
+
+    bool y4m;
+    bool full_range;
+    std::string params; // y4m header fields besides the size, from the input
+
+private:
+    bool write_frame(const ncnn::Mat &m)
+    {
+        if (!y4m)
+        {
+            const size_t size = frame_bytes(m);
+            return fwrite(m.data, 1, size, fp) == size && fflush(fp) == 0;
+        }
+
+        // the output size is only known with the first frame
+        if (!header_written)
+        {
+            fprintf(fp, "YUV4MPEG2 W%d H%d%s\n", m.w, m.h, params.c_str());
+            header_written = true;
+        }
+
+        const unsigned char *data = (const unsigned char *)m.data;
+        if (m.elempack != 1)
+        {
+            // converted on the host when the gpu path was not available
+            yuv.resize((size_t)m.w * m.h * 3 / 2);
+            rgb_to_yuv420(data, m.w, m.h, m.elempack, full_range, yuv.data());
+            data = yuv.data();
+        }
+
+        const size_t size = (size_t)m.w * m.h * 3 / 2;
+        return fputs("FRAME\n", fp) >= 0 && fwrite(data, 1, size, fp) == size && fflush(fp) == 0;
+    }
+
+    class Pending
+    {
+    public:
+        ncnn::Mat image;
+        bool malloced;
+    };
+
+    FILE *fp;
+
+    ncnn::Mutex lock;
+    std::map<int, Pending> pending;
+    int next;
+    bool ok; // stays false after the first failed write, the reader is gone
+    bool header_written;
+    std::vector<unsigned char> yuv;
+};
+
+#endif // FRAME_STREAM_H
@@ -0,0 +1,148 @@
+#ifndef HASH_H
+#define HASH_H
+
+// content hashing for the result cache, frame dedup and the tile cache
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+
+// xxh64, fast enough that hashing is noise next to decoding
+static uint64_t hash64(const void *data, size_t len, uint64_t seed)
+{
+    const uint64_t P1 = 11400714785074694791ULL;
+    const uint64_t P2 = 14029467366897019727ULL;
+    const uint64_t P3 = 1609587929392839161ULL;
+    const uint64_t P4 = 9650029242287828579ULL;
+    const uint64_t P5 = 2870177450012600261ULL;
+
+    struct op
+    {
+        static uint64_t rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+        static uint64_t round(uint64_t acc, uint64_t input)
+        {
+            acc += input * 14029467366897019727ULL;
+            return rotl(acc, 31) * 11400714785074694791ULL;
+        }
+        static uint64_t merge(uint64_t acc, uint64_t val)
+        {
+            acc ^= round(0, val);
+            return acc * 11400714785074694791ULL + 9650029242287828579ULL;
+        }
+        static uint64_t read64(const unsigned char *p)
+        {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            return v;
+        }
+        static uint32_t read32(const unsigned char *p)
+        {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return v;
+        }
+    };
+
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+
+    uint64_t h;
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+
+        const unsigned char *limit = end - 32;
+        do
+        {
+            v1 = op::round(v1, op::read64(p));
+            v2 = op::round(v2, op::read64(p + 8));
+            v3 = op::round(v3, op::read64(p + 16));
+            v4 = op::round(v4, op::read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = op::rotl(v1, 1) + op::rotl(v2, 7) + op::rotl(v3, 12) + op::rotl(v4, 18);
+        h = op::merge(h, v1);
+        h = op::merge(h, v2);
+        h = op::merge(h, v3);
+        h = op::merge(h, v4);
+    }
+    else
+    {
+        h = seed + P5;
+    }
+
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= op::round(0, op::read64(p));
+        h = op::rotl(h, 27) * P1 + P4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)op::read32(p) * P1;
+        h = op::rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        h ^= (*p) * P5;
+        h = op::rotl(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+// chained over 1 MB chunks, 0 when the file can't be read
+static uint64_t hash64_file(const std::filesystem::path &path, uint64_t seed)
+{
+#if _WIN32
+    FILE *fp = _wfopen(path.c_str(), L"rb");
+#else
+    FILE *fp = fopen(path.c_str(), "rb");
+#endif
+    if (!fp)
+        return 0;
+
+    std::string buf(1024 * 1024, '\0');
+
+    uint64_t h = seed;
+    for (;;)
+    {
+        const size_t n = fread(&buf[0], 1, buf.size(), fp);
+        if (n == 0)
+            break;
+        h = hash64(buf.data(), n, h);
+    }
+
+    fclose(fp);
+
+    return h;
+}
+
+// a w x h region of a strided image, rows chained, rowbytes is w * channels
+static uint64_t hash64_rows(const unsigned char *data, size_t stride, size_t rowbytes, int rows, uint64_t seed)
+{
+    uint64_t h = seed;
+    for (int y = 0; y < rows; y++)
+    {
+        h = hash64(data + y * stride, rowbytes, h);
+    }
+    return h;
+}
+
+#endif // HASH_H
@@ -0,0 +1,36 @@
+#ifndef IMAGE_RESIZE_H
+#define IMAGE_RESIZE_H
+
+// multithreaded image resize with stb_image_resize2
+// the output is split into stripes, each stripe is resampled on its own thread
+#ifndef STBIR_INCLUDE_STB_IMAGE_RESIZE2_H
+#include "stb_image_resize2.h"
+#endif
+
+// filter is one of stbir_filter, c is 3 for rgb and 4 for rgba
+int resize_image(const unsigned char *pixeldata, int w, int h, unsigned char *outdata, int outw, int outh, int c, int filter, int num_threads)
+{
+    STBIR_RESIZE resize;
+    stbir_resize_init(&resize, pixeldata, w, h, 0, outdata, outw, outh, 0, static_cast<stbir_pixel_layout>(c), STBIR_TYPE_UINT8_SRGB);
+
+    if (!stbir_set_filters(&resize, static_cast<stbir_filter>(filter), static_cast<stbir_filter>(filter)))
+        return 0;
+
+    const int splits = stbir_build_samplers_with_splits(&resize, num_threads < 1 ? 1 : num_threads);
+    if (splits == 0)
+        return 0;
+
+    int ret = 1;
+
+#pragma omp parallel for num_threads(splits) reduction(& : ret)
+    for (int i = 0; i < splits; i++)
+    {
+        ret &= stbir_resize_extended_split(&resize, i, 1) ? 1 : 0;
+    }
+
+    stbir_free_samplers(&resize);
+
+    return ret;
+}
+
+#endif // IMAGE_RESIZE_H
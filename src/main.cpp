@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <algorithm>
 #include <queue>
+#include <set>
 #include <vector>
 #include <clocale>
 #include <filesystem>
@@ -28,6 +29,7 @@ namespace fs = std::filesystem;
 #include "webp_image.h"
 #define STB_IMAGE_RESIZE2_IMPLEMENTATION
 #include "stb_image_resize2.h"
+#include "image_resize.h"
 
 static const char *resizemodes[] = {
     "default",      // STBIR_FILTER_DEFAULT
@@ -39,6 +41,28 @@ static const char *resizemodes[] = {
     "pointsample"   // STBIR_FILTER_POINT_SAMPLE
 };
 
+// long only options, above any short option character
+enum
+{
+    OPT_TRACE = 256,
+    OPT_PROGRESS_FD,
+    OPT_METRICS_LISTEN,
+    OPT_METRICS_FILE,
+    OPT_CACHE,
+    OPT_SKIP_EXISTING,
+    OPT_DEDUP,
+    OPT_TILE_CACHE,
+    OPT_SEQUENCE,
+    OPT_RAW,
+    OPT_ALPHA_NET,
+    OPT_PRECISION,
+    OPT_ROI,
+    OPT_PYRAMID,
+    OPT_OUT_OF_CORE,
+    OPT_NO_SKIP_UNIFORM,
+    OPT_NO_SKIP_TRANSPARENT,
+};
+
 #if _WIN32
 #include <wchar.h>
 static wchar_t *optarg = NULL;
@@ -69,6 +93,41 @@ static wchar_t getopt(int argc, wchar_t *const argv[], const wchar_t *optstring)
     return opt;
 }
 
+struct long_option
+{
+    const wchar_t *name;
+    int has_arg;
+    int val;
+};
+
+static wchar_t getopt_long(int argc, wchar_t *const argv[], const wchar_t *optstring, const long_option *longopts)
+{
+    if (optind >= argc || argv[optind][0] != L'-' || argv[optind][1] != L'-')
+        return getopt(argc, argv, optstring);
+
+    const wchar_t *name = argv[optind] + 2;
+    for (const long_option *o = longopts; o->name; o++)
+    {
+        if (wcscmp(name, o->name) != 0)
+            continue;
+
+        optarg = NULL;
+        optind++;
+
+        if (o->has_arg)
+        {
+            if (optind >= argc)
+                return L'?';
+
+            optarg = argv[optind++];
+        }
+
+        return (wchar_t)o->val;
+    }
+
+    return L'?';
+}
+
 static std::vector<int> parse_optarg_int_array(const wchar_t *optarg)
 {
     std::vector<int> array;
@@ -137,6 +196,7 @@ static bool parse_optarg_resize(const wchar_t *optarg, int *width, int *height,
 
 #else               // _WIN32
 #include <unistd.h> // getopt()
+#include <getopt.h> // getopt_long()
 
 static std::vector<int> parse_optarg_int_array(const char *optarg)
 {
@@ -194,6 +254,15 @@ static bool parse_optarg_resize(const char *optarg, int *width, int *height, int
 #include "realesrgan.h"
 
 #include "filesystem_utils.h"
+#include "frame_stream.h"
+#include "metrics.h"
+#include "model_planner.h"
+#include "png_stream.h"
+#include "progress.h"
+#include "pyramid_writer.h"
+#include "result_cache.h"
+#include "tile_cache.h"
+#include "trace.h"
 
 static void print_usage()
 {
@@ -202,18 +271,37 @@ static void print_usage()
     fprintf(stderr, "  -i input-path        input image path (jpg/png/webp) or directory\n");
     fprintf(stderr, "  -o output-path       output image path (jpg/png/webp) or directory\n");
     fprintf(stderr, "  -z model-scale       scale according to the model (can be 2, 3, 4. default=4)\n");
-    fprintf(stderr, "  -s output-scale      custom output scale (can be 2, 3, 4. default=4)\n");
+    fprintf(stderr, "  -s output-scale      custom output scale, fractional values like 2.5 are allowed (default=4)\n");
     fprintf(stderr, "  -r resize            resize output to dimension (default=WxH:default), use '-r help' for more details\n");
     fprintf(stderr, "  -w width             resize output to a width (default=W:default), use '-r help' for more details\n");
     fprintf(stderr, "  -c compress          compression of the output image, default 0 and varies to 100\n");
     fprintf(stderr, "  -t tile-size         tile size (>=32/0=auto, default=0) can be 0,0,0 for multi-gpu\n");
     fprintf(stderr, "  -m model-path        folder path to the pre-trained models. default=models\n");
     fprintf(stderr, "  -n model-name        model name (default=realesrgan-x4plus, can be realesr-animevideov3 | realesrgan-x4plus-anime | realesrnet-x4plus or any other model)\n");
-    fprintf(stderr, "  -g gpu-id            gpu device to use (default=auto) can be 0,1,2 for multi-gpu\n");
+    fprintf(stderr, "  -g gpu-id            gpu device to use (-1=cpu, default=auto) can be 0,1,2 for multi-gpu\n");
     fprintf(stderr, "  -j load:proc:save    thread count for load/proc/save (default=1:2:2) can be 1:2,2,2:2 for multi-gpu\n");
     fprintf(stderr, "  -x                   enable tta mode\n");
+    fprintf(stderr, "  -p                   downscale input before inference when no smaller model fits -s (faster, less detail)\n");
     fprintf(stderr, "  -f format            output image format (jpg/png/webp, default=ext/png)\n");
     fprintf(stderr, "  -v                   verbose output\n");
+    fprintf(stderr, "  --trace trace-path   write a chrome trace of every stage, open it in ui.perfetto.dev\n");
+    fprintf(stderr, "  --progress-fd fd     write progress as ndjson events to this file descriptor instead of stderr text\n");
+    fprintf(stderr, "  --metrics-listen addr  serve prometheus metrics on 127.0.0.1:port or unix:/path\n");
+    fprintf(stderr, "  --metrics-file path  rewrite prometheus metrics to this file every 5 seconds\n");
+    fprintf(stderr, "  --cache              reuse outputs of identical inputs and options, indexed in the output folder\n");
+    fprintf(stderr, "  --skip-existing      skip inputs whose output is up to date, only compares sizes and mtimes\n");
+    fprintf(stderr, "  --dedup              upscale identical frames once and copy the output to the others\n");
+    fprintf(stderr, "  --tile-cache size-mb reuse upscaled tiles with identical input, like flat backgrounds (gpu only)\n");
+    fprintf(stderr, "  --sequence           input is ordered video frames, reuse tiles unchanged since the previous frame\n");
+    fprintf(stderr, "  --raw WxH[:rgba]     -i and -o are raw rgb24 (or rgba) frame streams like ffmpeg pipes, - is stdin/stdout\n");
+    fprintf(stderr, "  --raw y4m            -i and -o are yuv4mpeg2 4:2:0 streams, converted on the gpu\n");
+    fprintf(stderr, "  --alpha-net          upscale the alpha channel with the model instead of bicubic, sharper sprite edges\n");
+    fprintf(stderr, "  --precision mode     fp32 | fp16s | fp16a | int8 (default=fp16s), int8 loads <model-name>-int8 from calibrate-int8.sh\n");
+    fprintf(stderr, "  --roi x,y,w,h        only upscale this region of each input, padded with the real pixels around it\n");
+    fprintf(stderr, "  --pyramid dzi|xyz    write a deep zoom or xyz tile pyramid in the output format instead of one image, band by band\n");
+    fprintf(stderr, "  --out-of-core        stream png inputs and the png output band by band, memory only grows with the image width\n");
+    fprintf(stderr, "  --no-skip-uniform    run the model on flat tiles too instead of filling them with its cached response\n");
+    fprintf(stderr, "  --no-skip-transparent run the model on rgba tiles without any visible pixel too instead of zero filling them\n");
 }
 
 static void print_resize_usage()
@@ -231,7 +319,9 @@ static void print_resize_usage()
     printf("  cubicbspline  - The cubic b-spline (aka Mitchell-Netrevalli with B=1,C=0), gaussian-esque\n");
     printf("  catmullrom    - An interpolating cubic spline\n");
     printf("  mitchell      - Mitchell-Netrevalli filter with B=1/3, C=1/3\n");
-    printf("  pointsample   - Simple point sampling\n");
+    printf("  pointsample   - Simple point sampling\n\n");
+
+    printf("box when shrinking and triangle when enlarging are done on the gpu, as part of the upscale.\n");
 }
 
 class Task
@@ -240,9 +330,34 @@ public:
     int id;
     int webp;
     bool outimage_malloced; // Flag to track if outimage.data was allocated with malloc
+    bool resized;           // outimage already has the size asked by -s / -r / -w
+
+    // milliseconds, for progress reporting
+    double decode_time;
+    double process_time;
+    double resize_time;
 
     path_t inpath;
     path_t outpath;
+    std::string cache_key; // empty without --cache
+
+    // decoded size, inimage is smaller when -p downscaled it
+    int srcw;
+    int srch;
+
+    // --roi of inimage, clipped to it, roi_w is 0 for the whole image
+    int roi_x;
+    int roi_y;
+    int roi_w;
+    int roi_h;
+
+    // --pyramid and --out-of-core, the proc thread writes the output band by band and outimage has no data
+    bool banded_ok;
+    uint64_t banded_bytes;
+
+    // first of a group of identical frames, the others wait for its output
+    bool dedup_leader;
+    std::pair<uint64_t, uint64_t> frame_key;
 
     ncnn::Mat inimage;
     ncnn::Mat outimage;
@@ -251,8 +366,9 @@ public:
 class TaskQueue
 {
 public:
-    TaskQueue()
+    TaskQueue(MetricGauge *_depth)
     {
+        depth = _depth;
     }
 
     void put(const Task &v)
@@ -265,6 +381,7 @@ public:
         }
 
         tasks.push(v);
+        depth->set((int64_t)tasks.size());
 
         lock.unlock();
 
@@ -282,6 +399,7 @@ public:
 
         v = tasks.front();
         tasks.pop();
+        depth->set((int64_t)tasks.size());
 
         lock.unlock();
 
@@ -292,22 +410,269 @@ private:
     ncnn::Mutex lock;
     ncnn::ConditionVariable condition;
     std::queue<Task> tasks;
+    MetricGauge *depth;
 };
 
-TaskQueue toproc;
-TaskQueue tosave;
+TaskQueue toproc(&Metrics::get().toproc_depth);
+TaskQueue tosave(&Metrics::get().tosave_depth);
+
+class SaveThreadParams
+{
+public:
+    int resizeWidth;
+    int resizeHeight;
+    int resizeMode;
+    bool resizeProvided;
+    float outputScale;
+    bool hasOutputScale;
+    bool hasCustomWidth;
+    float compression;
+    int verbose;
+    int resize_threads;
+    ResultCache *cache; // records written outputs, null without --cache / --skip-existing
+    FrameWriter *writer; // --raw, frames go to this stream instead of image files
+    int pyramid; // PYRAMID_DZI or PYRAMID_XYZ for --pyramid, the proc threads write the tiles then
+    bool out_of_core; // --out-of-core, the proc threads stream the png output and read png inputs as they go
+};
+
+// output size requested by -s / -r / -w, return false when the x{scale} output is kept
+static bool get_resize_size(int w, int h, const SaveThreadParams *stp, int *outw, int *outh)
+{
+    if (stp->hasOutputScale && !stp->resizeProvided && !stp->hasCustomWidth)
+    {
+        *outw = std::max((int)(w * stp->outputScale + 0.5f), 1);
+        *outh = std::max((int)(h * stp->outputScale + 0.5f), 1);
+        return true;
+    }
+
+    if (!stp->hasOutputScale && (stp->resizeProvided || stp->hasCustomWidth))
+    {
+        *outw = stp->resizeWidth;
+        *outh = stp->hasCustomWidth ? (h * stp->resizeWidth) / w : stp->resizeHeight;
+        return true;
+    }
+
+    return false;
+}
+
+// the gpu resample averages areas when shrinking and is bilinear when enlarging, only the filters it matches are sent there
+// w and h are the x{scale} output size, the default filter stays on the cpu
+static bool gpu_resample_matches(int mode, int w, int h, int outw, int outh)
+{
+    if (mode == STBIR_FILTER_BOX)
+        return outw <= w && outh <= h;
+
+    if (mode == STBIR_FILTER_TRIANGLE)
+        return outw >= w && outh >= h;
+
+    return false;
+}
 
 class LoadThreadParams
 {
 public:
     int scale;
     int jobs_load;
+    int prescale; // downscale the input by this factor before inference
+
+    // downscale on gpu instead of in the save thread when possible
+    const RealESRGAN *realesrgan;
+    const SaveThreadParams *stp;
+
+    ResultCache *cache;
+    bool use_cache;
+    bool skip_existing;
+    bool dedup;
+    FrameReader *reader; // --raw, frames come from this stream instead of input_files
+
+    // --roi, roi_w is 0 without it
+    int roi_x;
+    int roi_y;
+    int roi_w;
+    int roi_h;
 
     // session data
     std::vector<path_t> input_files;
     std::vector<path_t> output_files;
 };
 
+// --sequence reports frames finished in input order, every id has to end in done() once
+class FrameOrder
+{
+public:
+    FrameOrder()
+    {
+        enabled = false;
+        next = 0;
+    }
+
+    void wait_turn(int id)
+    {
+        if (!enabled)
+            return;
+
+        lock.lock();
+        while (next < id)
+        {
+            condition.wait(lock);
+        }
+        lock.unlock();
+    }
+
+    void done(int id)
+    {
+        if (!enabled)
+            return;
+
+        lock.lock();
+        finished.insert(id);
+        while (finished.erase(next))
+        {
+            next++;
+        }
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    bool enabled;
+
+private:
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::set<int> finished;
+    int next;
+};
+
+FrameOrder frame_order;
+
+static void skip_image(int id, const path_t &inpath, const path_t &outpath, const char *reason)
+{
+    ProgressImage image;
+    image.id = id;
+    image.input = Progress::utf8(inpath);
+    image.output = Progress::utf8(outpath);
+    Progress::image_skipped(image, reason);
+
+    Metrics::get().images_skipped.add(1);
+
+    frame_order.done(id);
+}
+
+// identical decoded frames of one batch share the output of the first of them
+class FrameDedup
+{
+public:
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    FrameDedup()
+    {
+        duplicates = 0;
+    }
+
+    // true when the frame is a duplicate, its output is then taken care of here and it must not be queued
+    bool add(const Key &key, int id, const path_t &inpath, const path_t &outpath)
+    {
+        Duplicate d;
+        d.id = id;
+        d.inpath = inpath;
+        d.outpath = outpath;
+
+        lock.lock();
+
+        std::map<Key, Frame>::iterator it = frames.find(key);
+        if (it == frames.end())
+        {
+            Frame &f = frames[key];
+            f.done = false;
+            f.success = false;
+            lock.unlock();
+            return false;
+        }
+
+        duplicates++;
+
+        Frame &f = it->second;
+        if (!f.done)
+        {
+            f.waiting.push_back(d);
+            lock.unlock();
+            return true;
+        }
+
+        const path_t source = f.outpath;
+        const bool success = f.success;
+
+        lock.unlock();
+
+        copy_output(source, success, d);
+        return true;
+    }
+
+    // the first frame was written, every duplicate waiting for it gets a copy
+    void finish(const Key &key, const path_t &outpath, bool success)
+    {
+        lock.lock();
+
+        Frame &f = frames[key];
+        f.done = true;
+        f.success = success;
+        f.outpath = outpath;
+
+        std::vector<Duplicate> waiting;
+        waiting.swap(f.waiting);
+
+        lock.unlock();
+
+        for (size_t i = 0; i < waiting.size(); i++)
+        {
+            copy_output(outpath, success, waiting[i]);
+        }
+    }
+
+    int duplicates;
+
+private:
+    class Duplicate
+    {
+    public:
+        int id;
+        path_t inpath;
+        path_t outpath;
+    };
+
+    class Frame
+    {
+    public:
+        bool done;
+        bool success;
+        path_t outpath;
+        std::vector<Duplicate> waiting;
+    };
+
+    static void copy_output(const path_t &source, bool success, const Duplicate &d)
+    {
+        if (success && clone_file(source, d.outpath))
+        {
+            skip_image(d.id, d.inpath, d.outpath, "duplicate");
+            return;
+        }
+
+#if _WIN32
+        fwprintf(stderr, L"🚨 Error: Couldn't write the image %s\n", d.outpath.c_str());
+#else
+        fprintf(stderr, "🚨 Error: Couldn't write the image %s\n", d.outpath.c_str());
+#endif
+
+        frame_order.done(d.id);
+    }
+
+    ncnn::Mutex lock;
+    std::map<Key, Frame> frames;
+};
+
+FrameDedup dedup;
+
 void *load(void *args)
 {
     const LoadThreadParams *ltp = (const LoadThreadParams *)args;
@@ -317,26 +682,76 @@ void *load(void *args)
 #pragma omp parallel for schedule(static, 1) num_threads(ltp->jobs_load)
     for (int i = 0; i < count; i++)
     {
+        Tracer::set_thread_name("load");
+
+        const double load_start = ncnn::get_current_time();
+
         const path_t &imagepath = ltp->input_files[i];
+        const path_t &outputpath = ltp->output_files[i];
+
+        if (ltp->skip_existing && ltp->cache->is_fresh(imagepath, outputpath))
+        {
+            skip_image(i, imagepath, outputpath, "up to date");
+            continue;
+        }
 
         int webp = 0;
+        std::string cache_key;
 
         unsigned char *pixeldata = 0;
         int w;
         int h;
         int c;
 
+        // --out-of-core, a png is only opened here for its size and read by the proc thread band by band
+        bool streamed = false;
+        if (ltp->stp->out_of_core)
+        {
+            PngReader png;
+            if (png.open(imagepath))
+            {
+                streamed = true;
+                w = png.w;
+                h = png.h;
+                c = png.c;
+            }
+        }
+
 #if _WIN32
-        FILE *fp = _wfopen(imagepath.c_str(), L"rb");
+        FILE *fp = streamed ? 0 : _wfopen(imagepath.c_str(), L"rb");
 #else
-        FILE *fp = fopen(imagepath.c_str(), "rb");
+        FILE *fp = streamed ? 0 : fopen(imagepath.c_str(), "rb");
 #endif
         if (fp)
         {
+            // sniff header, webp is decoded incrementally while the rest of the file is read
+            unsigned char header[4096];
+            int headerlen = (int)fread(header, 1, sizeof(header), fp);
+
+            // the cache needs every byte before decoding
+            if (!ltp->use_cache && webp_get_info(header, headerlen, &w, &h, &c))
+            {
+                TRACE_SCOPE("read+decode webp");
+
+                pixeldata = (unsigned char *)malloc((size_t)w * h * c);
+                if (pixeldata && !webp_load_incremental(fp, header, headerlen, pixeldata, w * c, w, h, c))
+                {
+                    free(pixeldata);
+                    pixeldata = 0;
+                }
+                if (pixeldata)
+                {
+                    webp = 1;
+                }
+            }
+
             // read whole file
             unsigned char *filedata = 0;
             int length = 0;
+            if (!webp)
             {
+                TRACE_SCOPE("read");
+
                 fseek(fp, 0, SEEK_END);
                 length = ftell(fp);
                 rewind(fp);
@@ -345,99 +760,232 @@ void *load(void *args)
                 {
                     fread(filedata, 1, length, fp);
                 }
-                fclose(fp);
             }
+            fclose(fp);
 
-            if (filedata)
+            if (filedata && ltp->use_cache)
             {
-                pixeldata = webp_load(filedata, length, &w, &h, &c);
-                if (pixeldata)
                 {
-                    webp = 1;
+                    TRACE_SCOPE("hash");
+                    cache_key = ltp->cache->key(filedata, length, outputpath);
                 }
-                else
+
+                if (ltp->cache->restore(cache_key, imagepath, outputpath))
                 {
-                    // not webp, try jpg png etc.
-#if _WIN32
-                    pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
+                    free(filedata);
+                    skip_image(i, imagepath, outputpath, "cached");
+                    continue;
+                }
+
+                if (webp_get_info(filedata, length, &w, &h, &c))
+                {
+                    TRACE_SCOPE("decode webp");
+
+                    pixeldata = webp_load(filedata, length, &w, &h, &c);
                     if (pixeldata)
                     {
-                        // WIC channel conversion logic similar to stb_image
-                        if (c == 1)
+                        webp = 1;
+                    }
+                    free(filedata);
+                    filedata = 0;
+                }
+            }
+
+            if (filedata)
+            {
+                TRACE_SCOPE("decode");
+
+                // not webp, try jpg png etc.
+#if _WIN32
+                pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
+                if (pixeldata)
+                {
+                    // WIC channel conversion logic similar to stb_image
+                    if (c == 1)
+                    {
+                        // grayscale -> rgb
+                        unsigned char *rgbdata = (unsigned char *)malloc(w * h * 3);
+                        if (rgbdata)
                         {
-                            // grayscale -> rgb
-                            unsigned char *rgbdata = (unsigned char *)malloc(w * h * 3);
-                            if (rgbdata)
+                            for (int i = 0; i < w * h; i++)
                             {
-                                for (int i = 0; i < w * h; i++)
-                                {
-                                    unsigned char gray = pixeldata[i];
-                                    rgbdata[i * 3 + 0] = gray; // B
-                                    rgbdata[i * 3 + 1] = gray; // G
-                                    rgbdata[i * 3 + 2] = gray; // R
-                                }
-                                free(pixeldata);
-                                pixeldata = rgbdata;
-                                c = 3;
+                                unsigned char gray = pixeldata[i];
+                                rgbdata[i * 3 + 0] = gray; // B
+                                rgbdata[i * 3 + 1] = gray; // G
+                                rgbdata[i * 3 + 2] = gray; // R
                             }
+                            free(pixeldata);
+                            pixeldata = rgbdata;
+                            c = 3;
                         }
-                        else if (c == 2)
+                    }
+                    else if (c == 2)
+                    {
+                        // grayscale + alpha -> rgba
+                        unsigned char *rgbadata = (unsigned char *)malloc(w * h * 4);
+                        if (rgbadata)
                         {
-                            // grayscale + alpha -> rgba
-                            unsigned char *rgbadata = (unsigned char *)malloc(w * h * 4);
-                            if (rgbadata)
+                            for (int i = 0; i < w * h; i++)
                             {
-                                for (int i = 0; i < w * h; i++)
-                                {
-                                    unsigned char gray = pixeldata[i * 2];
-                                    unsigned char alpha = pixeldata[i * 2 + 1];
-                                    rgbadata[i * 4 + 0] = gray;  // B
-                                    rgbadata[i * 4 + 1] = gray;  // G
-                                    rgbadata[i * 4 + 2] = gray;  // R
-                                    rgbadata[i * 4 + 3] = alpha; // A
-                                }
-                                free(pixeldata);
-                                pixeldata = rgbadata;
-                                c = 4;
+                                unsigned char gray = pixeldata[i * 2];
+                                unsigned char alpha = pixeldata[i * 2 + 1];
+                                rgbadata[i * 4 + 0] = gray;  // B
+                                rgbadata[i * 4 + 1] = gray;  // G
+                                rgbadata[i * 4 + 2] = gray;  // R
+                                rgbadata[i * 4 + 3] = alpha; // A
                             }
+                            free(pixeldata);
+                            pixeldata = rgbadata;
+                            c = 4;
                         }
                     }
+                }
 #else  // _WIN32
-                    pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 0);
-                    if (pixeldata)
+                pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 0);
+                if (pixeldata)
+                {
+                    // stb_image auto channel
+                    if (c == 1)
                     {
-                        // stb_image auto channel
-                        if (c == 1)
-                        {
-                            // grayscale -> rgb
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
-                            c = 3;
-                        }
-                        else if (c == 2)
-                        {
-                            // grayscale + alpha -> rgba
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 4);
-                            c = 4;
-                        }
+                        // grayscale -> rgb
+                        stbi_image_free(pixeldata);
+                        pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
+                        c = 3;
+                    }
+                    else if (c == 2)
+                    {
+                        // grayscale + alpha -> rgba
+                        stbi_image_free(pixeldata);
+                        pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 4);
+                        c = 4;
                     }
-#endif // _WIN32
                 }
+#endif // _WIN32
 
                 free(filedata);
             }
         }
-        if (pixeldata)
+        if ((pixeldata || streamed) && ltp->roi_w > 0 && (ltp->roi_x >= w || ltp->roi_y >= h))
+        {
+#if _WIN32
+            fwprintf(stderr, L"🚨 Error: The region is outside of the image '%s' (%dx%d)!\n", imagepath.c_str(), w, h);
+            free(pixeldata);
+#else  // _WIN32
+            fprintf(stderr, "🚨 Error: The region is outside of the image '%s' (%dx%d)!\n", imagepath.c_str(), w, h);
+            if (webp)
+                free(pixeldata);
+            else
+                stbi_image_free(pixeldata);
+#endif // _WIN32
+
+            frame_order.done(i);
+            continue;
+        }
+
+        FrameDedup::Key frame_key;
+        if (pixeldata && ltp->dedup)
+        {
+            TRACE_SCOPE("hash");
+
+            // the same pixels become a different file per output format
+            const path_t ext = get_file_extension(outputpath);
+            const int geometry[3] = {w, h, c};
+            const uint64_t seed = hash64(ext.data(), ext.size() * sizeof(path_t::value_type), hash64(geometry, sizeof(geometry), 0));
+            frame_key.first = hash64(pixeldata, (size_t)w * h * c, seed);
+            frame_key.second = hash64(pixeldata, (size_t)w * h * c, ~seed);
+
+            if (dedup.add(frame_key, i, imagepath, outputpath))
+            {
+#if _WIN32
+                free(pixeldata);
+#else
+                if (webp)
+                    free(pixeldata);
+                else
+                    stbi_image_free(pixeldata);
+#endif
+                continue;
+            }
+        }
+
+        if (pixeldata || streamed)
         {
             Task v;
             v.id = i;
+            v.webp = webp;
             v.inpath = imagepath;
-            v.outpath = ltp->output_files[i];
+            v.outpath = outputpath;
+            v.cache_key = cache_key;
+            v.dedup_leader = ltp->dedup;
+            v.frame_key = frame_key;
             v.outimage_malloced = false; // Initially managed by ncnn
 
+            // from here on the output is that of a roi sized image
+            v.roi_x = ltp->roi_x;
+            v.roi_y = ltp->roi_y;
+            v.roi_w = std::min(ltp->roi_w, w - ltp->roi_x);
+            v.roi_h = std::min(ltp->roi_h, h - ltp->roi_y);
+
+            v.srcw = v.roi_w > 0 ? v.roi_w : w;
+            v.srch = v.roi_w > 0 ? v.roi_h : h;
+
+            int resizew = 0;
+            int resizeh = 0;
+            bool resize = get_resize_size(v.srcw, v.srch, ltp->stp, &resizew, &resizeh);
+
+            if (resize && ltp->prescale > 1)
+            {
+                TRACE_SCOPE("prescale");
+
+                // fewer pixels through the network, gpu downscale brings the output to the requested size
+                const int pw = (w + ltp->prescale - 1) / ltp->prescale;
+                const int ph = (h + ltp->prescale - 1) / ltp->prescale;
+
+                unsigned char *prescaled = (unsigned char *)malloc((size_t)pw * ph * c);
+                if (prescaled && resize_image(pixeldata, w, h, prescaled, pw, ph, c, STBIR_FILTER_DEFAULT, 1))
+                {
+#if _WIN32
+                    free(pixeldata);
+#else
+                    stbi_image_free(pixeldata);
+#endif
+                    pixeldata = prescaled;
+                    w = pw;
+                    h = ph;
+                }
+                else
+                {
+                    free(prescaled);
+                }
+            }
+
+            const int inw = v.roi_w > 0 ? v.roi_w : w;
+            const int inh = v.roi_w > 0 ? v.roi_h : h;
+
+            int outw = inw * scale;
+            int outh = inh * scale;
+
+            // resample on gpu when it gives what the filter asks for, only the output size gets downloaded
+            // a roi is resized in the save thread
+            if (resize
+                && v.roi_w == 0
+                && gpu_resample_matches(ltp->stp->resizeMode, w * scale, h * scale, resizew, resizeh)
+                && ltp->realesrgan->support_resample(w, h, resizew, resizeh))
+            {
+                outw = resizew;
+                outh = resizeh;
+            }
+
             v.inimage = ncnn::Mat(w, h, (void *)pixeldata, (size_t)c, c);
-            v.outimage = ncnn::Mat(w * scale, h * scale, (size_t)c, c);
+            v.resized = resize && outw == resizew && outh == resizeh;
+            v.banded_ok = false;
+            v.banded_bytes = 0;
+
+            // only the size when the output is written band by band, it is never held in full
+            if (ltp->stp->pyramid || ltp->stp->out_of_core)
+                v.outimage = ncnn::Mat(outw, outh, (void *)0, (size_t)c, c);
+            else
+                v.outimage = ncnn::Mat(outw, outh, (size_t)c, c);
 
             path_t ext = get_file_extension(v.outpath);
             if (c == 4 && (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG")))
@@ -451,6 +999,11 @@ void *load(void *args)
 #endif // _WIN32
             }
 
+            v.decode_time = ncnn::get_current_time() - load_start;
+            v.process_time = 0;
+            v.resize_time = 0;
+
+            TRACE_SCOPE("wait toproc");
             toproc.put(v);
         }
         else
@@ -460,54 +1013,298 @@ void *load(void *args)
 #else  // _WIN32
             fprintf(stderr, "🚨 Error: Couldn't read the image '%s'! (channels: %d)\n", imagepath.c_str(), c);
 #endif // _WIN32
+
+            frame_order.done(i);
         }
     }
 
     return 0;
 }
 
+// --raw, frames are read in order until the stream ends, the frame index is the task id
+void *load_stream(void *args)
+{
+    const LoadThreadParams *ltp = (const LoadThreadParams *)args;
+    FrameReader *reader = ltp->reader;
+    const int scale = ltp->scale;
+    const int w = reader->w;
+    const int h = reader->h;
+    const int c = reader->c;
+
+    Tracer::set_thread_name("load");
+
+    // same for every frame
+    int outw = w * scale;
+    int outh = h * scale;
+    int resizew = 0;
+    int resizeh = 0;
+    if (get_resize_size(w, h, ltp->stp, &resizew, &resizeh)
+        && gpu_resample_matches(ltp->stp->resizeMode, w * scale, h * scale, resizew, resizeh)
+        && ltp->realesrgan->support_resample(w, h, resizew, resizeh))
+    {
+        outw = resizew;
+        outh = resizeh;
+    }
+
+    for (int i = 0;; i++)
+    {
+        const double load_start = ncnn::get_current_time();
+
+        unsigned char *pixeldata = (unsigned char *)malloc(reader->frame_size());
+        bool ok = false;
+        if (pixeldata)
+        {
+            TRACE_SCOPE("read");
+            ok = reader->read(pixeldata);
+        }
+        if (!ok)
+        {
+            free(pixeldata);
+            break;
+        }
+
+        Task v;
+        v.id = i;
+        v.webp = 1; // malloced, the save thread frees it with free()
+        v.inpath = ltp->input_files[0];
+        v.outpath = ltp->output_files[0];
+        v.dedup_leader = false;
+        v.outimage_malloced = false;
+        v.roi_x = 0;
+        v.roi_y = 0;
+        v.roi_w = 0;
+        v.roi_h = 0;
+        v.srcw = w;
+        v.srch = h;
+        v.banded_ok = false;
+        v.banded_bytes = 0;
+
+        if (reader->y4m && ltp->realesrgan->yuv420)
+        {
+            // planar all the way, 1.5 bytes per pixel in both directions
+            v.inimage = ncnn::Mat(w, h, (void *)pixeldata, (size_t)1u, 1);
+            v.outimage = ncnn::Mat(outw, outh, malloc((size_t)outw * outh * 3 / 2), (size_t)1u, 1);
+            v.outimage_malloced = true;
+        }
+        else
+        {
+            if (reader->y4m)
+            {
+                TRACE_SCOPE("yuv420 to rgb");
+
+                unsigned char *rgb = (unsigned char *)malloc((size_t)w * h * 3);
+                yuv420_to_rgb(pixeldata, w, h, reader->full_range, rgb);
+                free(pixeldata);
+                pixeldata = rgb;
+            }
+
+            v.inimage = ncnn::Mat(w, h, (void *)pixeldata, (size_t)c, c);
+            v.outimage = ncnn::Mat(outw, outh, (size_t)c, c);
+        }
+        v.resized = outw != w * scale || outh != h * scale;
+
+        v.decode_time = ncnn::get_current_time() - load_start;
+        v.process_time = 0;
+        v.resize_time = 0;
+
+        TRACE_SCOPE("wait toproc");
+        toproc.put(v);
+    }
+
+    return 0;
+}
+
 class ProcThreadParams
 {
 public:
     const RealESRGAN *realesrgan;
+    int device; // slot in Metrics::devices
+    const SaveThreadParams *stp;
+
+    double *skipped_time; // estimated milliseconds of inference saved by --sequence, single proc thread only
 };
 
+static int save_image(const path_t &path, int w, int h, int c, const unsigned char *pixeldata, const SaveThreadParams *stp);
+
+static int save_tile(const path_t &path, int w, int h, int c, const unsigned char *pixeldata, const void *userdata)
+{
+    return save_image(path, w, h, c, pixeldata, (const SaveThreadParams *)userdata);
+}
+
+// --pyramid and --out-of-core, the output comes one row of tiles at a time and goes straight into the pyramid or the png
+// a streamed png input is read as the bands need it, only a band and its padding rows are held
+static bool process_bands(const RealESRGAN *realesrgan, Task &v, const SaveThreadParams *stp)
+{
+    const int x = v.roi_w > 0 ? v.roi_x : 0;
+    const int y = v.roi_w > 0 ? v.roi_y : 0;
+    const int w = v.roi_w > 0 ? v.roi_w : v.inimage.w;
+    const int h = v.roi_w > 0 ? v.roi_h : v.inimage.h;
+    const int c = v.inimage.elempack;
+    const int scale = realesrgan->scale;
+    const int prepadding = realesrgan->prepadding;
+
+    PngReader reader;
+    const bool streamed = v.inimage.data == 0;
+    if (streamed && (!reader.open(v.inpath) || reader.w != v.inimage.w || reader.h != v.inimage.h || reader.c != c))
+        return false;
+
+    PyramidWriter pyramid;
+#if _WIN32
+    pyramid.parallel = false;
+#endif
+    PngWriter png;
+    if (stp->pyramid)
+    {
+        if (!pyramid.open(stp->pyramid, get_file_name_without_extension(v.outpath), get_file_extension(v.outpath), w * scale, h * scale, c, save_tile, stp))
+            return false;
+    }
+    else
+    {
+        std::error_code ec;
+        fs::create_directories(fs::absolute(v.outpath).parent_path(), ec);
+
+        // the same level as stbi_write_png_compression_level, -c 0 keeps 9
+        if (!png.open(v.outpath, w * scale, h * scale, c, stp->compression > 0 ? (int)stp->compression : 9))
+            return false;
+    }
+
+    // the band and its padding rows make one row of tiles
+    const int band = std::max(realesrgan->tilesize - prepadding * 2, realesrgan->tilesize / 2);
+
+    // input rows window_y0 to window_y1 of a streamed png
+    const size_t stride = (size_t)v.inimage.w * c;
+    std::vector<unsigned char> window;
+    int window_y0 = 0;
+    int window_y1 = 0;
+
+    // progress runs over the tiles image_start announced, each band takes its share of the rows
+    const int tilesize = realesrgan->tilesize;
+    const int tiles_total = ((w + tilesize - 1) / tilesize) * ((h + tilesize - 1) / tilesize);
+
+    ncnn::Mat out(w * scale, band * scale, (size_t)c, c);
+    for (int by = 0; by < h; by += band)
+    {
+        const int bh = std::min(band, h - by);
+        Progress::set_span((int)((long long)tiles_total * by / h), (int)((long long)tiles_total * (by + bh) / h), tiles_total);
+        ncnn::Mat out_band = bh == band ? out : ncnn::Mat(w * scale, bh * scale, (size_t)c, c);
+
+        ncnn::Mat in = v.inimage;
+        int in_y = y + by;
+        if (streamed)
+        {
+            TRACE_SCOPE("read png");
+
+            // the tiles of the band also read the padding rows around it
+            const int y0 = std::max(y + by - prepadding, 0);
+            const int y1 = std::min(y + by + bh + prepadding, v.inimage.h);
+
+            const int drop = std::min(y0, window_y1) - window_y0;
+            window.erase(window.begin(), window.begin() + (size_t)drop * stride);
+            window_y0 += drop;
+
+            if (window_y1 < y0)
+            {
+                if (!reader.skip_rows(y0 - window_y1))
+                    return false;
+                window_y0 = y0;
+                window_y1 = y0;
+            }
+
+            window.resize((size_t)(y1 - window_y0) * stride);
+            if (!reader.read_rows(&window[(size_t)(window_y1 - window_y0) * stride], y1 - window_y1))
+                return false;
+            window_y1 = y1;
+
+            in = ncnn::Mat(v.inimage.w, y1 - y0, (void *)window.data(), (size_t)c, c);
+            in_y = y + by - y0;
+        }
+
+        if (realesrgan->process_roi(in, x, in_y, w, bh, out_band) != 0)
+            return false;
+
+        TRACE_SCOPE(stp->pyramid ? "pyramid" : "write png");
+
+        const bool written = stp->pyramid ? pyramid.write_rows((const unsigned char *)out_band.data, bh * scale) : png.write_rows((const unsigned char *)out_band.data, bh * scale);
+        if (!written)
+            return false;
+    }
+
+    Progress::set_span(0, 0, 0);
+
+    const bool ok = stp->pyramid ? pyramid.finish() : png.close();
+    v.banded_bytes = stp->pyramid ? pyramid.bytes : png.bytes;
+
+    return ok;
+}
+
 void *proc(void *args)
 {
     const ProcThreadParams *ptp = (const ProcThreadParams *)args;
     const RealESRGAN *realesrgan = ptp->realesrgan;
 
+    Tracer::set_thread_name("proc");
+
     for (;;)
     {
         Task v;
 
-        toproc.get(v);
+        {
+            TRACE_SCOPE("wait toproc");
+            toproc.get(v);
+        }
 
         if (v.id == -233)
             break;
 
-        realesrgan->process(v.inimage, v.outimage);
+        {
+            ProgressImage image;
+            image.id = v.id;
+            image.input = Progress::utf8(v.inpath);
+            image.w = v.inimage.w;
+            image.h = v.inimage.h;
+            image.c = v.inimage.elempack;
+
+            const int tilesize = realesrgan->tilesize;
+            const int inw = v.roi_w > 0 ? v.roi_w : image.w;
+            const int inh = v.roi_w > 0 ? v.roi_h : image.h;
+            Progress::set_current_image(v.id);
+            Progress::image_start(image, ((inw + tilesize - 1) / tilesize) * ((inh + tilesize - 1) / tilesize));
+        }
 
+        {
+            TRACE_SCOPE("process");
+
+            const TileHistory *history = realesrgan->tile_history;
+            const uint64_t reused = history ? history->reused.load() : 0;
+            const uint64_t computed = history ? history->computed.load() : 0;
+
+            const double start = ncnn::get_current_time();
+            if (ptp->stp->pyramid || ptp->stp->out_of_core)
+                v.banded_ok = process_bands(realesrgan, v, ptp->stp);
+            else if (v.roi_w > 0)
+                realesrgan->process_roi(v.inimage, v.roi_x, v.roi_y, v.roi_w, v.roi_h, v.outimage);
+            else
+                realesrgan->process(v.inimage, v.outimage);
+            v.process_time = ncnn::get_current_time() - start;
+
+            // static tiles would have cost about as much as the ones that ran
+            if (history && history->computed.load() > computed)
+            {
+                const double tile_time = v.process_time / (history->computed.load() - computed);
+                ptp->skipped_time[0] += tile_time * (history->reused.load() - reused);
+            }
+        }
+
+        Metrics::get().devices[ptp->device]->busy_us.add((uint64_t)(v.process_time * 1000));
+        Metrics::get().sample_device_memory(ptp->device);
+
+        TRACE_SCOPE("wait tosave");
         tosave.put(v);
     }
 
     return 0;
 }
 
-class SaveThreadParams
-{
-public:
-    int resizeWidth;
-    int resizeHeight;
-    int resizeMode;
-    bool resizeProvided;
-    int outputScale;
-    bool hasOutputScale;
-    bool hasCustomWidth;
-    float compression;
-    int verbose;
-};
-
 void resize_output_image(Task &v, const SaveThreadParams *stp)
 {
     const int resizeWidth = stp->resizeWidth;
@@ -518,40 +1315,32 @@ void resize_output_image(Task &v, const SaveThreadParams *stp)
     if ((!resizeProvided && !hasCustomWidth) ||
         (v.outimage.w == resizeWidth && v.outimage.h == resizeHeight) || (!resizeHeight && hasCustomWidth && v.outimage.w == resizeWidth))
     {
-#if _WIN32
-        fwprintf(stderr, L"⏩ Skipping resize\n");
-#else  // _WIN32
-        fprintf(stderr, "⏩ Skipping resize\n");
-#endif // _WIN32
+        Progress::message("⏩ Skipping resize\n");
         return;
     }
 
+    const int inw = v.srcw;
+    const int inh = v.srch;
+
     // Calculate the resize height if not provided
     if (hasCustomWidth)
     {
-        resizeHeight = (v.inimage.h * resizeWidth) / v.inimage.w;
-#if _WIN32
-        fwprintf(stderr, L"🧮 Calculated height from width: %d\n", resizeHeight);
-#else  // _WIN32
-        fprintf(stderr, "🧮 Calculated height from width: %d\n", resizeHeight);
-#endif // _WIN32
+        resizeHeight = (inh * resizeWidth) / inw;
+        Progress::message("🧮 Calculated height from width: %d\n", resizeHeight);
     }
 
-#if _WIN32
-    fwprintf(stderr, L"🏞️ Resizing image according to desired resolution\n");
-#else  // _WIN32
-    fprintf(stderr, "🏞️ Resizing image according to desired resolution\n");
-#endif // _WIN32
+    Progress::message("🏞️ Resizing image according to desired resolution\n");
 
     int c = v.outimage.elempack;
 
-    stbir_pixel_layout layout = static_cast<stbir_pixel_layout>(c);
-
     // Create a new buffer for the resized image
     unsigned char *resizedData = (unsigned char *)malloc(resizeWidth * resizeHeight * c);
 
-    // Resize the image using stb_image_resize
-    stbir_resize_uint8_srgb((unsigned char *)v.outimage.data, v.outimage.w, v.outimage.h, 0, resizedData, resizeWidth, resizeHeight, 0, layout);
+    // Resize the image using stb_image_resize with the selected filter
+    {
+        TRACE_SCOPE("resize");
+        resize_image((const unsigned char *)v.outimage.data, v.outimage.w, v.outimage.h, resizedData, resizeWidth, resizeHeight, c, stp->resizeMode, stp->resize_threads);
+    }
 
     // Free the old output image data only if it was malloc'd
     if (v.outimage_malloced && v.outimage.data)
@@ -563,21 +1352,17 @@ void resize_output_image(Task &v, const SaveThreadParams *stp)
     v.outimage = ncnn::Mat(resizeWidth, resizeHeight, resizedData, (size_t)c, c);
     v.outimage_malloced = true; // Now managed by malloc
 
-#if _WIN32
-    fwprintf(stderr, L"🏞️ Resized image from %dx%d to %dx%d\n", v.inimage.w, v.inimage.h, v.outimage.w, v.outimage.h);
-#else  // _WIN32
-    fprintf(stderr, "🏞️ Resized image from %dx%d to %dx%d\n", v.inimage.w, v.inimage.h, v.outimage.w, v.outimage.h);
-#endif // _WIN32
+    Progress::message("🏞️ Resized image from %dx%d to %dx%d\n", inw, inh, v.outimage.w, v.outimage.h);
 }
 
 void scale_output_image(Task &v, const SaveThreadParams *stp)
 {
-    const int originalWidth = v.inimage.w;
-    const int originalHeight = v.inimage.h;
+    const int originalWidth = v.srcw;
+    const int originalHeight = v.srch;
     const bool hasOutputScale = stp->hasOutputScale;
-    const int outputScale = stp->outputScale;
-    const int outputWidth = originalWidth * outputScale;
-    const int outputHeight = originalHeight * outputScale;
+    const float outputScale = stp->outputScale;
+    const int outputWidth = std::max((int)(originalWidth * outputScale + 0.5f), 1);
+    const int outputHeight = std::max((int)(originalHeight * outputScale + 0.5f), 1);
     const bool resizeProvided = stp->resizeProvided;
     const bool hasCustomWidth = stp->hasCustomWidth;
 
@@ -586,16 +1371,14 @@ void scale_output_image(Task &v, const SaveThreadParams *stp)
 
     int c = v.outimage.elempack;
 
-#if _WIN32
-    fwprintf(stderr, L"🏞️ Resizing image according to output scale\n");
-#else  // _WIN32
-    fprintf(stderr, "🏞️ Resizing image according to output scale\n");
-#endif // _WIN32
+    Progress::message("🏞️ Resizing image according to output scale\n");
 
-    stbir_pixel_layout layout = static_cast<stbir_pixel_layout>(c);
     // Create a new buffer for the resized image
     unsigned char *resizedData = (unsigned char *)malloc(outputWidth * outputHeight * c);
-    stbir_resize_uint8_srgb((unsigned char *)v.outimage.data, v.outimage.w, v.outimage.h, 0, resizedData, outputWidth, outputHeight, 0, layout);
+    {
+        TRACE_SCOPE("resize");
+        resize_image((const unsigned char *)v.outimage.data, v.outimage.w, v.outimage.h, resizedData, outputWidth, outputHeight, c, stp->resizeMode, stp->resize_threads);
+    }
     
     // Free the old output image data only if it was malloc'd
     if (v.outimage_malloced && v.outimage.data)
@@ -606,23 +1389,57 @@ void scale_output_image(Task &v, const SaveThreadParams *stp)
     v.outimage = ncnn::Mat(outputWidth, outputHeight, resizedData, (size_t)v.outimage.elemsize, v.outimage.elemsize);
     v.outimage_malloced = true; // Now managed by malloc
 
+    Progress::message("🏞️ Scaled image from %dx%d to %dx%d\n", originalWidth, originalHeight, outputWidth, outputHeight);
+}
+
+// the extension of path picks the encoder, nonzero on success
+static int save_image(const path_t &path, int w, int h, int c, const unsigned char *pixeldata, const SaveThreadParams *stp)
+{
+    const path_t ext = get_file_extension(path);
+
+    if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
+    {
+        return webp_save(path.c_str(), w, h, c, pixeldata, 100 - (int)stp->compression);
+    }
+    if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
+    {
 #if _WIN32
-    fwprintf(stderr, L"🏞️ Resized image from %dx%d to %dx%d\n", originalWidth, originalHeight, outputWidth, outputHeight);
-#else  // _WIN32
-    fprintf(stderr, "🏞️ Scaled image from %dx%d to %dx%d\n", originalWidth, originalHeight, outputWidth, outputHeight);
-#endif // _WIN32
+        return wic_encode_image(path.c_str(), w, h, c, (void *)pixeldata);
+#else
+        // the compression level is set once in main, pyramid tiles are encoded on several threads
+        return stbi_write_png(path.c_str(), w, h, c, pixeldata, 0);
+#endif
+    }
+    if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
+    {
+#if _WIN32
+        if (stp->verbose)
+        {
+            fwprintf(stderr, L"🔧 Debug: Saving JPEG with %d channels, size %dx%d\n", c, w, h);
+        }
+        return wic_encode_jpeg_image(path.c_str(), w, h, c, (void *)pixeldata);
+#else
+        return stbi_write_jpg(path.c_str(), w, h, c, pixeldata, 100 - (int)stp->compression);
+#endif
+    }
+
+    return 0;
 }
 
 void *save(void *args)
 {
     const SaveThreadParams *stp = (const SaveThreadParams *)args;
-    const int verbose = stp->verbose;
+
+    Tracer::set_thread_name("save");
 
     for (;;)
     {
         Task v;
 
-        tosave.get(v);
+        {
+            TRACE_SCOPE("wait tosave");
+            tosave.get(v);
+        }
 
         if (v.id == -233)
             break;
@@ -644,82 +1461,58 @@ void *save(void *args)
             }
         }
 
-        if (stp->hasOutputScale)
+        const double resize_start = ncnn::get_current_time();
+
+        if (stp->hasOutputScale && !v.resized)
         {
             scale_output_image(v, stp);
         }
 
-        if ((stp->resizeProvided || stp->hasCustomWidth) && !stp->hasOutputScale)
+        if ((stp->resizeProvided || stp->hasCustomWidth) && !stp->hasOutputScale && !v.resized)
         {
             resize_output_image(v, stp);
         }
 
-        int success = 0;
-
-        path_t ext = get_file_extension(v.outpath);
+        const double save_start = ncnn::get_current_time();
+        v.resize_time = save_start - resize_start;
 
-        /* ----------- Create folder if not exists -------------------*/
-        fs::path fs_path = fs::absolute(v.outpath);
-#if _WIN32
-        std::wstring parent_path = fs_path.parent_path().wstring();
-#else
-        std::string parent_path = fs_path.parent_path().string();
-#endif
+        int success = 0;
 
-        if (!fs::exists(parent_path))
+        if (stp->writer)
         {
-            fprintf(stderr, "📂 Creating directory: %s\n", parent_path.c_str());
-            fs::create_directories(parent_path);
-        }
+            TRACE_SCOPE("write");
 
-        if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
-        {
-            success = webp_save(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, (const unsigned char *)v.outimage.data, 100 - (int)stp->compression);
+            const bool malloced = v.outimage_malloced;
+            v.outimage_malloced = false; // owned by the writer from here on
+            success = stp->writer->write(v.id, v.outimage, malloced);
         }
-        else if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
-        {
-#if _WIN32
-            success = wic_encode_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
-#else
-            // if compression is more than 0 make stbi_write_png_compression_level = 9
-            if (stp->compression > 0)
-            {
-                stbi_write_png_compression_level = stp->compression;
-            }
-            else
-            {
-                stbi_write_png_compression_level = 9;
-            }
-            success = stbi_write_png(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data, 0);
-#endif
-        }
-        else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
-        {
-#if _WIN32
-            if (verbose)
-            {
-                fwprintf(stderr, L"🔧 Debug: Saving JPEG with %d channels, size %dx%d\n", v.outimage.elempack, v.outimage.w, v.outimage.h);
-            }
-            success = wic_encode_jpeg_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
-#else
-            success = stbi_write_jpg(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data, 100 - (int)stp->compression);
-#endif
+        else if (stp->pyramid || stp->out_of_core)
+        {
+            // already written by the proc thread
+            success = v.banded_ok;
         }
-        if (success)
+        else
         {
-            fprintf(stderr, "100.00%\n");
-            fprintf(stderr, "\n🙌 Upscayled Successfully!\n");
-
-            if (verbose)
-            {
+            /* ----------- Create folder if not exists -------------------*/
+            fs::path fs_path = fs::absolute(v.outpath);
 #if _WIN32
-                fwprintf(stderr, L"✅ %ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+            std::wstring parent_path = fs_path.parent_path().wstring();
 #else
-                fprintf(stderr, "✅ %s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+            std::string parent_path = fs_path.parent_path().string();
 #endif
+
+            if (!fs::exists(parent_path))
+            {
+                Progress::message("📂 Creating directory: %s\n", Progress::utf8(parent_path).c_str());
+                fs::create_directories(parent_path);
             }
+
+            // the encoders write the file themselves, so both are one span, closed at the end of the task
+            TRACE_SCOPE("encode+write");
+
+            success = save_image(v.outpath, v.outimage.w, v.outimage.h, v.outimage.elempack, (const unsigned char *)v.outimage.data, stp);
         }
-        else
+        if (!success)
         {
 #if _WIN32
             fwprintf(stderr, L"🚨 Error: Couldn't write the image %s\n", v.outpath.c_str());
@@ -727,7 +1520,54 @@ void *save(void *args)
             fprintf(stderr, "🚨 Error: Couldn't write the image %s\n", v.outpath.c_str());
 #endif
         }
-        
+
+        if (success && stp->cache)
+        {
+            stp->cache->add(v.cache_key, v.inpath, v.outpath);
+        }
+
+        if (v.dedup_leader)
+        {
+            dedup.finish(v.frame_key, v.outpath, success != 0);
+        }
+
+        frame_order.wait_turn(v.id);
+
+        {
+            ProgressImage image;
+            image.id = v.id;
+            image.input = Progress::utf8(v.inpath);
+            image.output = Progress::utf8(v.outpath);
+            image.w = v.inimage.w;
+            image.h = v.inimage.h;
+            image.c = v.inimage.elempack;
+            image.outw = v.outimage.w;
+            image.outh = v.outimage.h;
+            image.ok = success != 0;
+            image.decode_time = v.decode_time;
+            image.process_time = v.process_time;
+            image.resize_time = v.resize_time;
+            image.save_time = ncnn::get_current_time() - save_start;
+
+            std::error_code ec;
+            const uintmax_t bytes = !success ? 0 : stp->writer ? (uintmax_t)FrameWriter::frame_bytes(v.outimage) : stp->pyramid || stp->out_of_core ? (uintmax_t)v.banded_bytes : fs::file_size(v.outpath, ec);
+            image.bytes = ec ? 0 : (long long)bytes;
+
+            Progress::image_finish(image);
+
+            Metrics &metrics = Metrics::get();
+            (image.ok ? metrics.images_ok : metrics.images_failed).add(1);
+            metrics.input_pixels.add((uint64_t)image.w * image.h);
+            metrics.output_pixels.add(image.ok ? (uint64_t)image.outw * image.outh : 0);
+            metrics.output_bytes.add((uint64_t)image.bytes);
+            metrics.stages[Metrics::STAGE_DECODE].observe(image.decode_time);
+            metrics.stages[Metrics::STAGE_PROCESS].observe(image.process_time);
+            metrics.stages[Metrics::STAGE_RESIZE].observe(image.resize_time);
+            metrics.stages[Metrics::STAGE_SAVE].observe(image.save_time);
+        }
+
+        frame_order.done(v.id);
+
         // Free output image data only if it was allocated with malloc
         if (v.outimage_malloced && v.outimage.data)
         {
@@ -748,10 +1588,10 @@ int main(int argc, char **argv)
     path_t inputpath;
     path_t outputpath;
     int scale = 4;
-    int resizeWidth;
-    int resizeHeight;
-    int resizeMode;
-    int outputScale = 4;
+    int resizeWidth = 0;
+    int resizeHeight = 0;
+    int resizeMode = 0;
+    float outputScale = 4.f;
     bool hasOutputScale = false;
     float compression = 0.00f;
     bool resizeProvided = false;
@@ -765,12 +1605,56 @@ int main(int argc, char **argv)
     int jobs_save = 2;
     int verbose = 0;
     int tta_mode = 0;
+    int allow_prescale = 0;
+    path_t tracepath;
+    int progress_fd = -1;
+    std::string metrics_listen;
+    path_t metrics_path;
+    int use_cache = 0;
+    int skip_existing = 0;
+    int use_dedup = 0;
+    int tile_cache_mb = 0;
+    int sequence = 0;
+    int raw = 0;
+    int raw_w = 0;
+    int raw_h = 0;
+    int raw_c = 0;
+    int raw_y4m = 0;
+    int alpha_net = 0;
+    int precision = PRECISION_FP16_STORAGE;
+    int roi_x = 0;
+    int roi_y = 0;
+    int roi_w = 0;
+    int roi_h = 0;
+    int pyramid = PYRAMID_NONE;
+    int out_of_core = 0;
+    int skip_uniform = 1;
+    int skip_transparent = 1;
     path_t format = PATHSTR("png");
 
 #if _WIN32
     setlocale(LC_ALL, "");
     wchar_t opt;
-    while ((opt = getopt(argc, argv, L"i:o:z:s:r:w:t:c:m:n:g:j:f:vxh")) != (wchar_t)-1)
+    static const long_option long_options[] = {
+        {L"trace", 1, OPT_TRACE},
+        {L"progress-fd", 1, OPT_PROGRESS_FD},
+        {L"metrics-listen", 1, OPT_METRICS_LISTEN},
+        {L"metrics-file", 1, OPT_METRICS_FILE},
+        {L"cache", 0, OPT_CACHE},
+        {L"skip-existing", 0, OPT_SKIP_EXISTING},
+        {L"dedup", 0, OPT_DEDUP},
+        {L"tile-cache", 1, OPT_TILE_CACHE},
+        {L"sequence", 0, OPT_SEQUENCE},
+        {L"raw", 1, OPT_RAW},
+        {L"alpha-net", 0, OPT_ALPHA_NET},
+        {L"precision", 1, OPT_PRECISION},
+        {L"roi", 1, OPT_ROI},
+        {L"pyramid", 1, OPT_PYRAMID},
+        {L"out-of-core", 0, OPT_OUT_OF_CORE},
+        {L"no-skip-uniform", 0, OPT_NO_SKIP_UNIFORM},
+        {L"no-skip-transparent", 0, OPT_NO_SKIP_TRANSPARENT},
+        {NULL, 0, 0}};
+    while ((opt = getopt_long(argc, argv, L"i:o:z:s:r:w:t:c:m:n:g:j:f:vxph", long_options)) != (wchar_t)-1)
     {
         switch (opt)
         {
@@ -784,7 +1668,7 @@ int main(int argc, char **argv)
             scale = _wtoi(optarg);
             break;
         case L's':
-            outputScale = _wtoi(optarg);
+            outputScale = (float)_wtof(optarg);
             hasOutputScale = true;
             break;
         case L'c':
@@ -847,6 +1731,79 @@ int main(int argc, char **argv)
         case L'x':
             tta_mode = 1;
             break;
+        case L'p':
+            allow_prescale = 1;
+            break;
+        case OPT_TRACE:
+            tracepath = optarg;
+            break;
+        case OPT_PROGRESS_FD:
+            progress_fd = _wtoi(optarg);
+            break;
+        case OPT_METRICS_LISTEN:
+            metrics_listen = Progress::utf8(std::wstring(optarg));
+            break;
+        case OPT_METRICS_FILE:
+            metrics_path = optarg;
+            break;
+        case OPT_CACHE:
+            use_cache = 1;
+            break;
+        case OPT_SKIP_EXISTING:
+            skip_existing = 1;
+            break;
+        case OPT_DEDUP:
+            use_dedup = 1;
+            break;
+        case OPT_TILE_CACHE:
+            tile_cache_mb = _wtoi(optarg);
+            break;
+        case OPT_SEQUENCE:
+            sequence = 1;
+            break;
+        case OPT_RAW:
+            if (!parse_raw_format(Progress::utf8(std::wstring(optarg)).c_str(), &raw_w, &raw_h, &raw_c, &raw_y4m))
+            {
+                fwprintf(stderr, L"🚨 Error: Invalid raw frame format, expected WxH, WxH:rgb24, WxH:rgba or y4m!\n");
+                return -1;
+            }
+            raw = 1;
+            break;
+        case OPT_ALPHA_NET:
+            alpha_net = 1;
+            break;
+        case OPT_PRECISION:
+            precision = parse_precision(Progress::utf8(std::wstring(optarg)).c_str());
+            if (precision == -1)
+            {
+                fwprintf(stderr, L"🚨 Error: Invalid precision, expected fp32, fp16s, fp16a or int8!\n");
+                return -1;
+            }
+            break;
+        case OPT_ROI:
+            if (swscanf(optarg, L"%d,%d,%d,%d", &roi_x, &roi_y, &roi_w, &roi_h) != 4 || roi_x < 0 || roi_y < 0 || roi_w <= 0 || roi_h <= 0)
+            {
+                fwprintf(stderr, L"🚨 Error: Invalid region, expected x,y,w,h!\n");
+                return -1;
+            }
+            break;
+        case OPT_PYRAMID:
+            pyramid = wcscmp(optarg, L"dzi") == 0 ? PYRAMID_DZI : wcscmp(optarg, L"xyz") == 0 ? PYRAMID_XYZ : PYRAMID_NONE;
+            if (pyramid == PYRAMID_NONE)
+            {
+                fwprintf(stderr, L"🚨 Error: Invalid pyramid layout, expected dzi or xyz!\n");
+                return -1;
+            }
+            break;
+        case OPT_OUT_OF_CORE:
+            out_of_core = 1;
+            break;
+        case OPT_NO_SKIP_UNIFORM:
+            skip_uniform = 0;
+            break;
+        case OPT_NO_SKIP_TRANSPARENT:
+            skip_transparent = 0;
+            break;
         case L'h':
         default:
             print_usage();
@@ -856,7 +1813,26 @@ int main(int argc, char **argv)
 #else  // _WIN32
     int opt;
     fprintf(stderr, "🚀 Starting Upscayl - Copyright © 2024\n");
-    while ((opt = getopt(argc, argv, "i:o:z:s:r:w:t:c:m:n:g:j:f:vxh")) != -1)
+    static const struct option long_options[] = {
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"progress-fd", required_argument, NULL, OPT_PROGRESS_FD},
+        {"metrics-listen", required_argument, NULL, OPT_METRICS_LISTEN},
+        {"metrics-file", required_argument, NULL, OPT_METRICS_FILE},
+        {"cache", no_argument, NULL, OPT_CACHE},
+        {"skip-existing", no_argument, NULL, OPT_SKIP_EXISTING},
+        {"dedup", no_argument, NULL, OPT_DEDUP},
+        {"tile-cache", required_argument, NULL, OPT_TILE_CACHE},
+        {"sequence", no_argument, NULL, OPT_SEQUENCE},
+        {"raw", required_argument, NULL, OPT_RAW},
+        {"alpha-net", no_argument, NULL, OPT_ALPHA_NET},
+        {"precision", required_argument, NULL, OPT_PRECISION},
+        {"roi", required_argument, NULL, OPT_ROI},
+        {"pyramid", required_argument, NULL, OPT_PYRAMID},
+        {"out-of-core", no_argument, NULL, OPT_OUT_OF_CORE},
+        {"no-skip-uniform", no_argument, NULL, OPT_NO_SKIP_UNIFORM},
+        {"no-skip-transparent", no_argument, NULL, OPT_NO_SKIP_TRANSPARENT},
+        {NULL, 0, NULL, 0}};
+    while ((opt = getopt_long(argc, argv, "i:o:z:s:r:w:t:c:m:n:g:j:f:vxph", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -870,7 +1846,7 @@ int main(int argc, char **argv)
             scale = atoi(optarg);
             break;
         case 's':
-            outputScale = atoi(optarg);
+            outputScale = (float)atof(optarg);
             hasOutputScale = true;
             break;
         case 'c':
@@ -933,6 +1909,79 @@ int main(int argc, char **argv)
         case 'x':
             tta_mode = 1;
             break;
+        case 'p':
+            allow_prescale = 1;
+            break;
+        case OPT_TRACE:
+            tracepath = optarg;
+            break;
+        case OPT_PROGRESS_FD:
+            progress_fd = atoi(optarg);
+            break;
+        case OPT_METRICS_LISTEN:
+            metrics_listen = optarg;
+            break;
+        case OPT_METRICS_FILE:
+            metrics_path = optarg;
+            break;
+        case OPT_CACHE:
+            use_cache = 1;
+            break;
+        case OPT_SKIP_EXISTING:
+            skip_existing = 1;
+            break;
+        case OPT_DEDUP:
+            use_dedup = 1;
+            break;
+        case OPT_TILE_CACHE:
+            tile_cache_mb = atoi(optarg);
+            break;
+        case OPT_SEQUENCE:
+            sequence = 1;
+            break;
+        case OPT_RAW:
+            if (!parse_raw_format(optarg, &raw_w, &raw_h, &raw_c, &raw_y4m))
+            {
+                fprintf(stderr, "🚨 Error: Invalid raw frame format, expected WxH, WxH:rgb24, WxH:rgba or y4m!\n");
+                return -1;
+            }
+            raw = 1;
+            break;
+        case OPT_ALPHA_NET:
+            alpha_net = 1;
+            break;
+        case OPT_PRECISION:
+            precision = parse_precision(optarg);
+            if (precision == -1)
+            {
+                fprintf(stderr, "🚨 Error: Invalid precision, expected fp32, fp16s, fp16a or int8!\n");
+                return -1;
+            }
+            break;
+        case OPT_ROI:
+            if (sscanf(optarg, "%d,%d,%d,%d", &roi_x, &roi_y, &roi_w, &roi_h) != 4 || roi_x < 0 || roi_y < 0 || roi_w <= 0 || roi_h <= 0)
+            {
+                fprintf(stderr, "🚨 Error: Invalid region, expected x,y,w,h!\n");
+                return -1;
+            }
+            break;
+        case OPT_PYRAMID:
+            pyramid = strcmp(optarg, "dzi") == 0 ? PYRAMID_DZI : strcmp(optarg, "xyz") == 0 ? PYRAMID_XYZ : PYRAMID_NONE;
+            if (pyramid == PYRAMID_NONE)
+            {
+                fprintf(stderr, "🚨 Error: Invalid pyramid layout, expected dzi or xyz!\n");
+                return -1;
+            }
+            break;
+        case OPT_OUT_OF_CORE:
+            out_of_core = 1;
+            break;
+        case OPT_NO_SKIP_UNIFORM:
+            skip_uniform = 0;
+            break;
+        case OPT_NO_SKIP_TRANSPARENT:
+            skip_transparent = 0;
+            break;
         case 'h':
         default:
             print_usage();
@@ -946,6 +1995,94 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    if (!tracepath.empty())
+    {
+        Tracer::enable();
+        Tracer::set_thread_name("main");
+    }
+
+    if (raw)
+    {
+        // frames only exist in memory, there is nothing to hash, stat or copy
+        if (use_cache || skip_existing || use_dedup || allow_prescale || roi_w)
+        {
+            fprintf(stderr, "ℹ️ Info: --cache, --skip-existing, --dedup, -p and --roi are ignored for raw streams\n");
+        }
+        use_cache = 0;
+        skip_existing = 0;
+        use_dedup = 0;
+        allow_prescale = 0;
+        roi_w = 0;
+
+        // 4:2:0 frames keep the x{scale} size
+        if (raw_y4m && (hasOutputScale || resizeProvided || hasCustomWidth))
+        {
+            fprintf(stderr, "ℹ️ Info: -s, -r and -w are ignored for y4m streams, pick a model of the wanted scale\n");
+            hasOutputScale = false;
+            resizeProvided = false;
+            hasCustomWidth = false;
+        }
+
+        if (progress_fd == 1 && outputpath == PATHSTR("-"))
+        {
+            fprintf(stderr, "🚨 Error: Progress events and raw frames can't both go to stdout!\n");
+            return -1;
+        }
+    }
+
+    if (pyramid && raw)
+    {
+        fprintf(stderr, "🚨 Error: --pyramid writes image files, not raw streams!\n");
+        return -1;
+    }
+
+    if (out_of_core && raw)
+    {
+        fprintf(stderr, "🚨 Error: --out-of-core reads and writes png files, raw frames are already streamed!\n");
+        return -1;
+    }
+
+    // the lower pyramid levels are the resized outputs, and there is no single output file to hash, copy or index
+    if (pyramid && (use_cache || skip_existing || use_dedup || sequence || allow_prescale || hasOutputScale || resizeProvided || hasCustomWidth))
+    {
+        fprintf(stderr, "ℹ️ Info: --cache, --skip-existing, --dedup, --sequence, -p, -s, -r and -w are ignored with --pyramid\n");
+        use_cache = 0;
+        skip_existing = 0;
+        use_dedup = 0;
+        sequence = 0;
+        allow_prescale = 0;
+        hasOutputScale = false;
+        resizeProvided = false;
+        hasCustomWidth = false;
+    }
+
+    // a streamed input is never whole in memory to hash, downscale or resize, and the png is written before the save thread sees it
+    if (out_of_core && !pyramid && (use_cache || skip_existing || use_dedup || sequence || allow_prescale || hasOutputScale || resizeProvided || hasCustomWidth))
+    {
+        fprintf(stderr, "ℹ️ Info: --cache, --skip-existing, --dedup, --sequence, -p, -s, -r and -w are ignored with --out-of-core\n");
+        use_cache = 0;
+        skip_existing = 0;
+        use_dedup = 0;
+        sequence = 0;
+        allow_prescale = 0;
+        hasOutputScale = false;
+        resizeProvided = false;
+        hasCustomWidth = false;
+    }
+
+    // the roi is in input pixels, a downscaled input would move it
+    if (roi_w && allow_prescale)
+    {
+        fprintf(stderr, "ℹ️ Info: -p is ignored with --roi\n");
+        allow_prescale = 0;
+    }
+
+    if (hasOutputScale && !(outputScale > 0.f))
+    {
+        fprintf(stderr, "🚨 Error: Invalid output scale!\n");
+        return -1;
+    }
+
     if (tilesize.size() != (gpuid.empty() ? 1 : gpuid.size()) && !tilesize.empty())
     {
         fprintf(stderr, "🚨 Error: Invalid tile size!\n");
@@ -1011,11 +2148,41 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    // only png is written incrementally, pyramid tiles are small enough for any format
+    if (out_of_core && !pyramid)
+    {
+        const path_t ext = path_is_directory(outputpath) ? format : get_file_extension(outputpath);
+        if (ext != PATHSTR("png") && ext != PATHSTR("PNG"))
+        {
+            fprintf(stderr, "🚨 Error: --out-of-core writes png, use a .png output or -f png!\n");
+            return -1;
+        }
+    }
+
     // collect input and output filepath
     std::vector<path_t> input_files;
     std::vector<path_t> output_files;
+    FrameReader reader;
+    FrameWriter writer;
     {
-        if (path_is_directory(inputpath) && path_is_directory(outputpath))
+        if (raw)
+        {
+            input_files.push_back(inputpath);
+            output_files.push_back(outputpath);
+
+            // opening a fifo blocks until the other end shows up
+            const int ret = raw_y4m ? reader.open_y4m(inputpath) : reader.open(inputpath, raw_w, raw_h, raw_c);
+            if (ret != 0 || writer.open(outputpath) != 0)
+            {
+                fprintf(stderr, "🚨 Error: Couldn't open the raw frame streams\n");
+                return -1;
+            }
+
+            writer.y4m = reader.y4m;
+            writer.full_range = reader.full_range;
+            writer.params = reader.params;
+        }
+        else if (path_is_directory(inputpath) && path_is_directory(outputpath))
         {
             std::vector<path_t> filenames;
             int lr = list_directory(inputpath, filenames);
@@ -1160,6 +2327,57 @@ int main(int argc, char **argv)
     path_t paramfullpath = sanitize_filepath(parampath);
     path_t modelfullpath = sanitize_filepath(modelpath);
 
+    // the model itself knows its scale better than its file name, the plan and -p depend on it
+    const int param_scale = estimate_model_scale(paramfullpath);
+    if (param_scale > 0 && param_scale != scale)
+    {
+        fprintf(stderr, "✨ Model output is x%d, using it instead of x%d\n", param_scale, scale);
+        scale = param_scale;
+    }
+
+    // run a smaller native scale model of the same family instead of throwing away most of the x{scale} output
+    int prescale = 1;
+    if (hasOutputScale && outputScale < scale && !resizeProvided && !hasCustomWidth)
+    {
+        ModelPlan plan;
+        double current_macs = 0;
+        if (plan_model(paramfullpath, scale, outputScale, &plan, &current_macs))
+        {
+            const double saving = current_macs > 0 ? (1.0 - plan.macs / current_macs) * 100 : 0;
+#if _WIN32
+            fwprintf(stderr, L"✨ Using %ls (x%d) for output scale x%g, estimated %.0f%% fewer FLOPs\n", plan.name.c_str(), plan.scale, outputScale, saving);
+#else
+            fprintf(stderr, "✨ Using %s (x%d) for output scale x%g, estimated %.0f%% fewer FLOPs\n", plan.name.c_str(), plan.scale, outputScale, saving);
+#endif
+            paramfullpath = plan.parampath;
+            modelfullpath = plan.modelpath;
+            scale = plan.scale;
+        }
+        else if (allow_prescale && outputScale == (int)outputScale && scale % (int)outputScale == 0)
+        {
+            prescale = scale / (int)outputScale;
+
+            fprintf(stderr, "✨ Downscaling input by %d before inference, estimated %.0f%% fewer FLOPs\n", prescale, (1.0 - 1.0 / (prescale * prescale)) * 100);
+        }
+    }
+
+    // the quantized model sits next to the float one, written by calibrate-int8.sh
+    if (precision == PRECISION_INT8)
+    {
+        paramfullpath = paramfullpath.substr(0, paramfullpath.size() - 6) + PATHSTR("-int8.param");
+        modelfullpath = modelfullpath.substr(0, modelfullpath.size() - 4) + PATHSTR("-int8.bin");
+
+        if (!filepath_is_readable(paramfullpath) || !filepath_is_readable(modelfullpath))
+        {
+#if _WIN32
+            fwprintf(stderr, L"🚨 Error: %ls not found, run calibrate-int8.sh first\n", paramfullpath.c_str());
+#else
+            fprintf(stderr, "🚨 Error: %s not found, run calibrate-int8.sh first\n", paramfullpath.c_str());
+#endif
+            return -1;
+        }
+    }
+
 #if _WIN32
     CoInitializeEx(NULL, COINIT_MULTITHREADED);
 #endif
@@ -1168,7 +2386,22 @@ int main(int argc, char **argv)
 
     if (gpuid.empty())
     {
-        gpuid.push_back(ncnn::get_default_gpu_index());
+        // fall back to cpu when there is no vulkan device at all
+        gpuid.push_back(ncnn::get_gpu_count() > 0 ? ncnn::get_default_gpu_index() : -1);
+    }
+
+    if (sequence && (gpuid.size() > 1 || jobs_load > 1 || (!jobs_proc.empty() && jobs_proc[0] > 1)))
+    {
+        // the previous frame's tiles are only valid when frames are loaded and processed one after another
+        fprintf(stderr, "ℹ️ Info: Sequence mode loads and upscales frames in order on a single thread\n");
+    }
+    if (sequence)
+    {
+        gpuid.resize(1);
+        jobs_load = 1;
+        jobs_proc.assign(1, 1);
+        if (tilesize.size() > 1)
+            tilesize.resize(1);
     }
 
     const int use_gpu_count = (int)gpuid.size();
@@ -1190,18 +2423,31 @@ int main(int argc, char **argv)
     int gpu_count = ncnn::get_gpu_count();
     for (int i = 0; i < use_gpu_count; i++)
     {
-        if (gpuid[i] < 0 || gpuid[i] >= gpu_count)
+        if (gpuid[i] < -1 || gpuid[i] >= gpu_count)
         {
             fprintf(stderr, "🚨 Error: Invalid GPU Device\n");
 
             ncnn::destroy_gpu_instance();
             return -1;
         }
+
+        if (precision == PRECISION_INT8 && gpuid[i] != -1)
+        {
+            fprintf(stderr, "ℹ️ Info: ncnn runs int8 convolutions on the cpu only, the gpu %d will mostly wait on downloads, -g -1 is faster\n", gpuid[i]);
+        }
     }
 
     int total_jobs_proc = 0;
     for (int i = 0; i < use_gpu_count; i++)
     {
+        if (gpuid[i] == -1)
+        {
+            // ncnn already spreads one inference over all cpu cores
+            jobs_proc[i] = 1;
+            total_jobs_proc += jobs_proc[i];
+            continue;
+        }
+
         int gpu_queue_count = ncnn::get_gpu_info(gpuid[i]).compute_queue_count();
         jobs_proc[i] = std::min(jobs_proc[i], gpu_queue_count);
         total_jobs_proc += jobs_proc[i];
@@ -1212,6 +2458,12 @@ int main(int argc, char **argv)
         if (tilesize[i] != 0)
             continue;
 
+        if (gpuid[i] == -1)
+        {
+            tilesize[i] = 200;
+            continue;
+        }
+
         uint32_t heap_budget = ncnn::get_gpu_device(gpuid[i])->get_heap_budget();
 
         // more fine-grained tilesize policy here
@@ -1231,33 +2483,171 @@ int main(int argc, char **argv)
     {
         std::vector<RealESRGAN *> realesrgan(use_gpu_count);
 
+        TileCache *tile_cache = tile_cache_mb > 0 ? new TileCache((size_t)tile_cache_mb * 1024 * 1024) : 0;
+        Metrics::get().tile_cache = tile_cache;
+
+        TileHistory *tile_history = sequence ? new TileHistory : 0;
+        double skipped_time = 0;
+        frame_order.enabled = sequence != 0;
+
         for (int i = 0; i < use_gpu_count; i++)
         {
             realesrgan[i] = new RealESRGAN(gpuid[i], tta_mode);
 
+            realesrgan[i]->precision = precision;
             realesrgan[i]->load(paramfullpath, modelfullpath);
 
+            // load() ran the model once, which also catches layers the .param walk doesn't know
+            const int native_scale = realesrgan[i]->native_scale;
+            if (native_scale > 0 && native_scale != scale)
+            {
+                fprintf(stderr, "✨ Model output is x%d, using it instead of x%d\n", native_scale, scale);
+                scale = native_scale;
+
+                // -p was worked out for the other scale
+                prescale = 1;
+            }
+
             realesrgan[i]->scale = scale;
             realesrgan[i]->tilesize = tilesize[i];
             realesrgan[i]->prepadding = prepadding;
+            realesrgan[i]->tile_cache = tile_cache;
+            realesrgan[i]->tile_history = tile_history;
+            realesrgan[i]->alpha_net = alpha_net != 0;
+            realesrgan[i]->skip_uniform = skip_uniform != 0;
+            realesrgan[i]->skip_transparent = skip_transparent != 0;
+        }
+
+        // y4m frames stay yuv420 up to the shaders when every device can, otherwise they are converted on the host
+        if (raw_y4m)
+        {
+            bool gpu_yuv420 = true;
+            for (int i = 0; i < use_gpu_count; i++)
+            {
+                gpu_yuv420 = gpu_yuv420 && realesrgan[i]->support_yuv420();
+            }
+
+            for (int i = 0; i < use_gpu_count; i++)
+            {
+                realesrgan[i]->yuv420 = gpu_yuv420;
+                realesrgan[i]->yuv_full_range = reader.full_range;
+            }
+
+            if (!gpu_yuv420)
+            {
+                fprintf(stderr, "ℹ️ Info: Converting y4m frames on the cpu, the gpu path needs int8 storage and no tta\n");
+            }
+        }
+
+        // everything besides the input bytes that shapes the output, the format is part of each key
+        ResultCache cache;
+        bool cache_ok = false;
+        if (use_cache || skip_existing)
+        {
+            std::string options;
+            {
+                char buf[512];
+                sprintf(buf, "scale=%d output-scale=%g/%d prescale=%d tta=%d alpha-net=%d skip-uniform=%d skip-transparent=%d precision=%s roi=%d,%d,%d,%d resize=%dx%d/%d/%d/%d compression=%g tiles=", scale, outputScale, hasOutputScale, prescale, tta_mode, alpha_net, skip_uniform, skip_transparent, precision_name(precision), roi_x, roi_y, roi_w, roi_h, resizeWidth, resizeHeight, resizeMode, resizeProvided, hasCustomWidth, compression);
+                options = buf;
+                for (size_t i = 0; i < tilesize.size(); i++)
+                {
+                    options += std::to_string(tilesize[i]) + ",";
+                }
+            }
+
+            uint64_t options_hash = hash64_file(paramfullpath, 0);
+            options_hash = hash64_file(modelfullpath, options_hash);
+            options_hash = hash64(options.data(), options.size(), options_hash);
+
+            const fs::path cachedir = path_is_directory(outputpath) ? fs::path(outputpath) : fs::absolute(fs::path(outputpath)).parent_path();
+            std::error_code ec;
+            fs::create_directories(cachedir, ec);
+
+            cache_ok = cache.open(cachedir, options_hash) == 0;
+            if (!cache_ok)
+            {
+                fprintf(stderr, "⚠️ Warning: Couldn't open the cache index, every image is processed\n");
+            }
         }
 
         // main routine
         {
+            SaveThreadParams stp;
+            stp.resizeWidth = resizeWidth;
+            stp.resizeHeight = resizeHeight;
+            stp.resizeMode = resizeMode;
+            stp.resizeProvided = resizeProvided;
+            stp.verbose = verbose;
+            stp.compression = compression;
+            stp.outputScale = outputScale;
+            stp.hasOutputScale = hasOutputScale;
+            stp.hasCustomWidth = hasCustomWidth;
+            stp.resize_threads = std::max(1, cpu_count / jobs_save);
+            stp.cache = cache_ok ? &cache : 0;
+            stp.writer = 0;
+            stp.pyramid = pyramid;
+            stp.out_of_core = out_of_core != 0;
+
+#if !_WIN32
+            // level 9 unless -c asks for less, set once as the pyramid tiles are encoded on several threads
+            stbi_write_png_compression_level = compression > 0 ? (int)compression : 9;
+#endif
+
+            if (raw)
+            {
+                stp.writer = &writer;
+
+                int outw = reader.w * scale;
+                int outh = reader.h * scale;
+                get_resize_size(reader.w, reader.h, &stp, &outw, &outh);
+                fprintf(stderr, "ℹ️ Info: Writing %s frames of %dx%d\n", raw_y4m ? "y4m" : raw_c == 4 ? "raw rgba" : "raw rgb24", outw, outh);
+            }
+
+            Progress::start(progress_fd >= 0 ? Progress::NDJSON : Progress::HUMAN, progress_fd, verbose);
+
+            Metrics::get().set_devices(gpuid);
+            if (!metrics_listen.empty() && Metrics::get().listen(metrics_listen) != 0)
+            {
+                fprintf(stderr, "🚨 Error: Couldn't serve metrics on %s\n", metrics_listen.c_str());
+            }
+            if (!metrics_path.empty() && Metrics::get().dump(metrics_path) != 0)
+            {
+#if _WIN32
+                fwprintf(stderr, L"🚨 Error: Couldn't write the metrics %ls\n", metrics_path.c_str());
+#else
+                fprintf(stderr, "🚨 Error: Couldn't write the metrics %s\n", metrics_path.c_str());
+#endif
+            }
+
             // load image
             LoadThreadParams ltp;
             ltp.scale = scale;
             ltp.jobs_load = jobs_load;
+            ltp.prescale = prescale;
+            ltp.realesrgan = realesrgan[0];
+            ltp.stp = &stp;
+            ltp.cache = stp.cache;
+            ltp.use_cache = cache_ok && use_cache;
+            ltp.skip_existing = cache_ok && skip_existing;
+            ltp.dedup = use_dedup;
+            ltp.reader = raw ? &reader : 0;
+            ltp.roi_x = roi_x;
+            ltp.roi_y = roi_y;
+            ltp.roi_w = roi_w;
+            ltp.roi_h = roi_h;
             ltp.input_files = input_files;
             ltp.output_files = output_files;
 
-            ncnn::Thread load_thread(load, (void *)&ltp);
+            ncnn::Thread load_thread(raw ? load_stream : load, (void *)&ltp);
 
             // realesrgan proc
             std::vector<ProcThreadParams> ptp(use_gpu_count);
             for (int i = 0; i < use_gpu_count; i++)
             {
                 ptp[i].realesrgan = realesrgan[i];
+                ptp[i].device = i;
+                ptp[i].skipped_time = &skipped_time;
+                ptp[i].stp = &stp;
             }
 
             std::vector<ncnn::Thread *> proc_threads(total_jobs_proc);
@@ -1273,17 +2663,6 @@ int main(int argc, char **argv)
             }
 
             // save image
-            SaveThreadParams stp;
-            stp.resizeWidth = resizeWidth;
-            stp.resizeHeight = resizeHeight;
-            stp.resizeMode = resizeMode;
-            stp.resizeProvided = resizeProvided;
-            stp.verbose = verbose;
-            stp.compression = compression;
-            stp.outputScale = outputScale;
-            stp.hasOutputScale = hasOutputScale;
-            stp.hasCustomWidth = hasCustomWidth;
-
             std::vector<ncnn::Thread *> save_threads(jobs_save);
             for (int i = 0; i < jobs_save; i++)
             {
@@ -1317,6 +2696,26 @@ int main(int argc, char **argv)
                 save_threads[i]->join();
                 delete save_threads[i];
             }
+
+            if (use_dedup)
+            {
+                Progress::message("♻️ Reused %d duplicate frames of %d\n", dedup.duplicates, (int)input_files.size());
+            }
+            if (tile_cache)
+            {
+                const uint64_t lookups = tile_cache->lookups.load();
+                const uint64_t hits = tile_cache->hits.load();
+                Progress::message("♻️ Reused %llu tiles of %llu (%.1f%%)\n", (unsigned long long)hits, (unsigned long long)lookups, lookups ? hits * 100.0 / lookups : 0.0);
+            }
+            if (tile_history)
+            {
+                const uint64_t reused = tile_history->reused.load();
+                const uint64_t total = reused + tile_history->computed.load();
+                Progress::message("♻️ Reused %llu static tiles of %llu (%.1f%%), about %.1fs of inference skipped\n", (unsigned long long)reused, (unsigned long long)total, total ? reused * 100.0 / total : 0.0, skipped_time / 1000);
+            }
+
+            Metrics::get().stop();
+            Progress::stop();
         }
 
         for (int i = 0; i < use_gpu_count; i++)
@@ -1324,6 +2723,19 @@ int main(int argc, char **argv)
             delete realesrgan[i];
         }
         realesrgan.clear();
+
+        Metrics::get().tile_cache = 0;
+        delete tile_cache;
+        delete tile_history;
+    }
+
+    if (!tracepath.empty() && Tracer::write(tracepath) != 0)
+    {
+#if _WIN32
+        fwprintf(stderr, L"🚨 Error: Couldn't write the trace %ls\n", tracepath.c_str());
+#else
+        fprintf(stderr, "🚨 Error: Couldn't write the trace %s\n", tracepath.c_str());
+#endif
     }
 
     ncnn::destroy_gpu_instance();
@@ -0,0 +1,451 @@
+// metrics exporter, kept out of the header so the socket headers stay in one translation unit
+#if _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+// ncnn
+#include "benchmark.h"
+#include "gpu.h"
+
+#include "metrics.h"
+#include "tile_cache.h"
+
+#if _WIN32
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+typedef int socket_t;
+#define close_socket close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static void appendf(std::string &str, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    str += buf;
+}
+
+static int64_t host_memory_peak()
+{
+#if _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return (int64_t)pmc.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if __APPLE__
+    return (int64_t)usage.ru_maxrss;
+#else
+    return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+Metrics::Metrics()
+{
+    start_time = ncnn::get_current_time();
+    stopping = false;
+    exporter = 0;
+    server = -1;
+    tile_cache = 0;
+}
+
+void Metrics::sample_device_memory(int i)
+{
+    const int gpuid = devices[i]->gpuid;
+    if (gpuid < 0)
+        return;
+
+    const ncnn::GpuInfo &info = ncnn::get_gpu_info(gpuid);
+    if (!info.support_VK_EXT_memory_budget() || !ncnn::vkGetPhysicalDeviceMemoryProperties2KHR)
+        return;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget;
+    memset(&budget, 0, sizeof(budget));
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2KHR properties;
+    memset(&properties, 0, sizeof(properties));
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    properties.pNext = &budget;
+
+    ncnn::vkGetPhysicalDeviceMemoryProperties2KHR(info.physical_device(), &properties);
+
+    // heapUsage is what this process holds, not the whole device
+    int64_t usage = 0;
+    for (uint32_t j = 0; j < properties.memoryProperties.memoryHeapCount; j++)
+    {
+        if (properties.memoryProperties.memoryHeaps[j].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            usage += (int64_t)budget.heapUsage[j];
+    }
+
+    devices[i]->memory_bytes.set(usage);
+}
+
+std::string Metrics::text()
+{
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        sample_device_memory((int)i);
+    }
+
+    std::string str;
+
+    str += "# HELP upscayl_images_total Images finished, by whether the output was written or already up to date.\n";
+    str += "# TYPE upscayl_images_total counter\n";
+    appendf(str, "upscayl_images_total{result=\"ok\"} %llu\n", (unsigned long long)images_ok.get());
+    appendf(str, "upscayl_images_total{result=\"failed\"} %llu\n", (unsigned long long)images_failed.get());
+    appendf(str, "upscayl_images_total{result=\"skipped\"} %llu\n", (unsigned long long)images_skipped.get());
+
+    str += "# HELP upscayl_input_pixels_total Pixels decoded from finished images.\n";
+    str += "# TYPE upscayl_input_pixels_total counter\n";
+    appendf(str, "upscayl_input_pixels_total %llu\n", (unsigned long long)input_pixels.get());
+
+    str += "# HELP upscayl_output_pixels_total Pixels encoded into finished images.\n";
+    str += "# TYPE upscayl_output_pixels_total counter\n";
+    appendf(str, "upscayl_output_pixels_total %llu\n", (unsigned long long)output_pixels.get());
+
+    str += "# HELP upscayl_output_bytes_total Bytes of written output files.\n";
+    str += "# TYPE upscayl_output_bytes_total counter\n";
+    appendf(str, "upscayl_output_bytes_total %llu\n", (unsigned long long)output_bytes.get());
+
+    str += "# HELP upscayl_stage_duration_seconds Per image time spent in each pipeline stage.\n";
+    str += "# TYPE upscayl_stage_duration_seconds histogram\n";
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        const MetricHistogram &h = stages[s];
+        const double *bounds = MetricHistogram::bounds();
+
+        uint64_t count = 0;
+        for (int i = 0; i < MetricHistogram::BUCKETS; i++)
+        {
+            count += h.counts[i].load(std::memory_order_relaxed);
+
+            if (i < MetricHistogram::BUCKETS - 1)
+                appendf(str, "upscayl_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", stage_name(s), bounds[i], (unsigned long long)count);
+            else
+                appendf(str, "upscayl_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", stage_name(s), (unsigned long long)count);
+        }
+        appendf(str, "upscayl_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n", stage_name(s), h.sum_us.load(std::memory_order_relaxed) / 1000000.0);
+        appendf(str, "upscayl_stage_duration_seconds_count{stage=\"%s\"} %llu\n", stage_name(s), (unsigned long long)count);
+    }
+
+    if (tile_cache)
+    {
+        str += "# HELP upscayl_tile_cache_lookups_total Tiles looked up in the tile cache.\n";
+        str += "# TYPE upscayl_tile_cache_lookups_total counter\n";
+        appendf(str, "upscayl_tile_cache_lookups_total %llu\n", (unsigned long long)tile_cache->lookups.load(std::memory_order_relaxed));
+
+        str += "# HELP upscayl_tile_cache_hits_total Tiles reused instead of upscaled.\n";
+        str += "# TYPE upscayl_tile_cache_hits_total counter\n";
+        appendf(str, "upscayl_tile_cache_hits_total %llu\n", (unsigned long long)tile_cache->hits.load(std::memory_order_relaxed));
+    }
+
+    str += "# HELP upscayl_queue_depth Tasks waiting in the queue between two stages.\n";
+    str += "# TYPE upscayl_queue_depth gauge\n";
+    appendf(str, "upscayl_queue_depth{queue=\"toproc\"} %lld\n", (long long)toproc_depth.get());
+    appendf(str, "upscayl_queue_depth{queue=\"tosave\"} %lld\n", (long long)tosave_depth.get());
+
+    str += "# HELP upscayl_queue_depth_peak Highest queue depth seen so far.\n";
+    str += "# TYPE upscayl_queue_depth_peak gauge\n";
+    appendf(str, "upscayl_queue_depth_peak{queue=\"toproc\"} %lld\n", (long long)toproc_depth.get_peak());
+    appendf(str, "upscayl_queue_depth_peak{queue=\"tosave\"} %lld\n", (long long)tosave_depth.get_peak());
+
+    str += "# HELP upscayl_device_busy_seconds_total Time spent upscaling on each device, summed over its proc threads.\n";
+    str += "# TYPE upscayl_device_busy_seconds_total counter\n";
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        appendf(str, "upscayl_device_busy_seconds_total{gpu=\"%d\"} %.6f\n", devices[i]->gpuid, devices[i]->busy_us.get() / 1000000.0);
+    }
+
+    str += "# HELP upscayl_device_memory_bytes Device local memory held by this process, 0 when the driver does not report it.\n";
+    str += "# TYPE upscayl_device_memory_bytes gauge\n";
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        appendf(str, "upscayl_device_memory_bytes{gpu=\"%d\"} %lld\n", devices[i]->gpuid, (long long)devices[i]->memory_bytes.get());
+    }
+
+    str += "# HELP upscayl_device_memory_peak_bytes Highest sampled device local memory.\n";
+    str += "# TYPE upscayl_device_memory_peak_bytes gauge\n";
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        appendf(str, "upscayl_device_memory_peak_bytes{gpu=\"%d\"} %lld\n", devices[i]->gpuid, (long long)devices[i]->memory_bytes.get_peak());
+    }
+
+    str += "# HELP upscayl_host_memory_peak_bytes Peak resident memory of this process.\n";
+    str += "# TYPE upscayl_host_memory_peak_bytes gauge\n";
+    appendf(str, "upscayl_host_memory_peak_bytes %lld\n", (long long)host_memory_peak());
+
+    str += "# HELP upscayl_uptime_seconds Time since startup.\n";
+    str += "# TYPE upscayl_uptime_seconds gauge\n";
+    appendf(str, "upscayl_uptime_seconds %.3f\n", (ncnn::get_current_time() - start_time) / 1000);
+
+    return str;
+}
+
+int Metrics::listen(const std::string &addr)
+{
+#if _WIN32
+    WSADATA wsadata;
+    if (WSAStartup(MAKEWORD(2, 2), &wsadata) != 0)
+        return -1;
+#endif
+
+    socket_t s;
+
+    if (addr.compare(0, 5, "unix:") == 0)
+    {
+#if _WIN32
+        return -1;
+#else
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (addr.size() - 5 >= sizeof(sa.sun_path))
+            return -1;
+        strcpy(sa.sun_path, addr.c_str() + 5);
+
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0)
+            return -1;
+
+        // a stale socket file from an earlier run would make bind fail
+        unlink(sa.sun_path);
+
+        if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0 || ::listen(s, 4) != 0)
+        {
+            close_socket(s);
+            return -1;
+        }
+
+        unix_path = sa.sun_path;
+#endif
+    }
+    else
+    {
+        const int port = atoi(addr.c_str());
+        if (port <= 0 || port > 65535)
+            return -1;
+
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s == (socket_t)-1)
+            return -1;
+
+        int reuse = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+        // local only, there is no authentication
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons((unsigned short)port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0 || ::listen(s, 4) != 0)
+        {
+            close_socket(s);
+            return -1;
+        }
+    }
+
+    server = (intptr_t)s;
+
+    start_exporter();
+
+    return 0;
+}
+
+#if _WIN32
+int Metrics::dump(const std::wstring &path)
+#else
+int Metrics::dump(const std::string &path)
+#endif
+{
+    dump_path = path;
+
+    if (write_dump() != 0)
+        return -1;
+
+    start_exporter();
+
+    return 0;
+}
+
+void Metrics::stop()
+{
+    if (!exporter)
+        return;
+
+    stopping.store(true, std::memory_order_relaxed);
+
+    exporter->join();
+    delete exporter;
+    exporter = 0;
+
+    if (!dump_path.empty())
+        write_dump();
+
+    if (server != -1)
+    {
+        close_socket((socket_t)server);
+        server = -1;
+    }
+
+#if !_WIN32
+    if (!unix_path.empty())
+        unlink(unix_path.c_str());
+#endif
+}
+
+void Metrics::start_exporter()
+{
+    if (!exporter)
+        exporter = new ncnn::Thread(exporter_main, this);
+}
+
+void *Metrics::exporter_main(void *args)
+{
+    Metrics *m = (Metrics *)args;
+
+    const double dump_interval_ms = 5000;
+    double last_dump = ncnn::get_current_time();
+
+    while (!m->stopping.load(std::memory_order_relaxed))
+    {
+        // also the poll interval for stop()
+        m->serve_one();
+
+        if (!m->dump_path.empty() && ncnn::get_current_time() - last_dump >= dump_interval_ms)
+        {
+            m->write_dump();
+            last_dump = ncnn::get_current_time();
+        }
+    }
+
+    return 0;
+}
+
+// waits up to 200 ms for one scrape and answers it
+void Metrics::serve_one()
+{
+    // only --metrics-file, winsock select fails at once without sockets and wsastartup is not called then
+    if (server == -1)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return;
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 200 * 1000;
+
+    const socket_t s = (socket_t)server;
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(s, &fds);
+    if (select((int)s + 1, &fds, NULL, NULL, &timeout) <= 0)
+        return;
+
+    const socket_t c = accept(s, NULL, NULL);
+    if (c == (socket_t)-1)
+        return;
+
+    // a client that connects and never sends must not stall the exporter
+#if _WIN32
+    DWORD recv_timeout = 1000;
+#else
+    struct timeval recv_timeout;
+    recv_timeout.tv_sec = 1;
+    recv_timeout.tv_usec = 0;
+#endif
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (const char *)&recv_timeout, sizeof(recv_timeout));
+
+    // only the request line matters
+    char request[1024];
+    const int n = recv(c, request, sizeof(request) - 1, 0);
+    request[n > 0 ? n : 0] = '\0';
+
+    std::string response;
+    if (strncmp(request, "GET / ", 6) == 0 || strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET /metrics?", 13) == 0)
+    {
+        const std::string body = text();
+        appendf(response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", (int)body.size());
+        response += body;
+    }
+    else
+    {
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        const int r = send(c, response.c_str() + sent, (int)(response.size() - sent), MSG_NOSIGNAL);
+        if (r <= 0)
+            break;
+        sent += r;
+    }
+
+    close_socket(c);
+}
+
+// written aside and renamed over, readers never see a partial file
+int Metrics::write_dump()
+{
+    const std::string body = text();
+
+#if _WIN32
+    const std::wstring tmppath = dump_path + L".tmp";
+    FILE *fp = _wfopen(tmppath.c_str(), L"wb");
+#else
+    const std::string tmppath = dump_path + ".tmp";
+    FILE *fp = fopen(tmppath.c_str(), "wb");
+#endif
+    if (!fp)
+        return -1;
+
+    const size_t written = fwrite(body.data(), 1, body.size(), fp);
+    fclose(fp);
+
+    if (written != body.size())
+        return -1;
+
+#if _WIN32
+    if (!MoveFileExW(tmppath.c_str(), dump_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        return -1;
+#else
+    if (rename(tmppath.c_str(), dump_path.c_str()) != 0)
+        return -1;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// live counters for --metrics-listen and --metrics-file, rendered as prometheus text
+// every update is a relaxed atomic, exporting reads them while the pipeline keeps running
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "platform.h"
+
+class TileCache;
+
+class MetricCounter
+{
+public:
+    MetricCounter()
+    {
+        value = 0;
+    }
+
+    void add(uint64_t v)
+    {
+        value.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value;
+};
+
+// current value plus the highest value ever set
+class MetricGauge
+{
+public:
+    MetricGauge()
+    {
+        value = 0;
+        peak = 0;
+    }
+
+    void set(int64_t v)
+    {
+        value.store(v, std::memory_order_relaxed);
+
+        int64_t p = peak.load(std::memory_order_relaxed);
+        while (v > p && !peak.compare_exchange_weak(p, v, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    int64_t get() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    int64_t get_peak() const
+    {
+        return peak.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> value;
+    std::atomic<int64_t> peak;
+};
+
+// durations in fixed buckets, observed in milliseconds and exported in seconds
+class MetricHistogram
+{
+public:
+    enum
+    {
+        BUCKETS = 14
+    };
+
+    static const double *bounds()
+    {
+        // seconds, the last bucket is +Inf
+        static const double b[BUCKETS - 1] = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 120};
+        return b;
+    }
+
+    MetricHistogram()
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            counts[i] = 0;
+        }
+        sum_us = 0;
+    }
+
+    void observe(double ms)
+    {
+        const double *b = bounds();
+
+        int i = 0;
+        while (i < BUCKETS - 1 && ms > b[i] * 1000)
+        {
+            i++;
+        }
+
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add((uint64_t)(ms * 1000), std::memory_order_relaxed);
+    }
+
+    // not cumulative, the exporter sums them up
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> sum_us;
+};
+
+// one per gpu in use
+class MetricDevice
+{
+public:
+    int gpuid;                // -1 is cpu
+    MetricCounter busy_us;    // time spent in process(), summed over the proc threads of this device
+    MetricGauge memory_bytes; // device local heap usage, when the driver reports it
+};
+
+class Metrics
+{
+public:
+    static Metrics &get()
+    {
+        static Metrics m;
+        return m;
+    }
+
+    // call once before any proc thread starts, the list is never resized afterwards
+    void set_devices(const std::vector<int> &gpuids)
+    {
+        for (size_t i = 0; i < gpuids.size(); i++)
+        {
+            MetricDevice *device = new MetricDevice;
+            device->gpuid = gpuids[i];
+            devices.push_back(device);
+        }
+    }
+
+    // reads the device local heap usage of the device in slot i, cheap enough to call per image
+    void sample_device_memory(int i);
+
+    std::string text();
+
+    // tcp port on 127.0.0.1, or unix:/path where available
+    int listen(const std::string &addr);
+
+    // rewritten every interval and once more on stop()
+#if _WIN32
+    int dump(const std::wstring &path);
+#else
+    int dump(const std::string &path);
+#endif
+
+    void stop();
+
+public:
+    enum
+    {
+        STAGE_DECODE = 0,
+        STAGE_PROCESS,
+        STAGE_RESIZE,
+        STAGE_SAVE,
+        STAGE_COUNT
+    };
+
+    static const char *stage_name(int stage)
+    {
+        static const char *names[STAGE_COUNT] = {"decode", "process", "resize", "save"};
+        return names[stage];
+    }
+
+    MetricCounter images_ok;
+    MetricCounter images_failed;
+    MetricCounter images_skipped; // --cache / --skip-existing
+    MetricCounter input_pixels;
+    MetricCounter output_pixels;
+    MetricCounter output_bytes;
+    MetricHistogram stages[STAGE_COUNT];
+    MetricGauge toproc_depth;
+    MetricGauge tosave_depth;
+    std::vector<MetricDevice *> devices;
+    const TileCache *tile_cache; // --tile-cache
+
+private:
+    Metrics();
+
+    double start_time;
+
+    // exporter
+    std::atomic<bool> stopping;
+    ncnn::Thread *exporter;
+    intptr_t server;
+    std::string unix_path;
+#if _WIN32
+    std::wstring dump_path;
+#else
+    std::string dump_path;
+#endif
+
+    static void *exporter_main(void *args);
+    void serve_one();
+    int write_dump();
+    void start_exporter();
+};
+
+#endif // METRICS_H
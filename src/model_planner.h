@@ -0,0 +1,264 @@
+#ifndef MODEL_PLANNER_H
+#define MODEL_PLANNER_H
+
+// pick the cheapest model of the same family for a requested output scale
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "filesystem_utils.h"
+
+static bool is_ascii_digit(int c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool is_ascii_alpha(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// native scale from the xN / Nx token in a model name, 0 if there is none
+// pos and len receive the token span
+static int parse_model_scale(const path_t &name, size_t *pos, size_t *len)
+{
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if (name[i] != 'x' && name[i] != 'X')
+            continue;
+
+        // xN, not inside a word
+        if ((i == 0 || !is_ascii_alpha(name[i - 1])) && i + 1 < name.size() && is_ascii_digit(name[i + 1]))
+        {
+            size_t j = i + 1;
+            while (j < name.size() && is_ascii_digit(name[j]))
+                j++;
+
+            *pos = i;
+            *len = j - i;
+            return atoi(std::string(name.begin() + i + 1, name.begin() + j).c_str());
+        }
+
+        // Nx, not followed by a word
+        if (i > 0 && is_ascii_digit(name[i - 1]) && (i + 1 == name.size() || !is_ascii_alpha(name[i + 1])))
+        {
+            size_t j = i;
+            while (j > 0 && is_ascii_digit(name[j - 1]))
+                j--;
+
+            if (j > 0 && is_ascii_alpha(name[j - 1]))
+                continue;
+
+            *pos = j;
+            *len = i + 1 - j;
+            return atoi(std::string(name.begin() + j, name.begin() + i).c_str());
+        }
+    }
+
+    return 0;
+}
+
+// multiply-accumulates per input pixel, from the layer shapes in a text .param
+// blob sizes are tracked relative to the input so upsampling layers are accounted for
+// output_area receives the area of the output blob relative to the input, 0 when there is none
+static double estimate_model_macs(const path_t &parampath, double *output_area = 0)
+{
+    if (output_area)
+        *output_area = 0;
+
+#if _WIN32
+    FILE *fp = _wfopen(parampath.c_str(), L"rb");
+#else
+    FILE *fp = fopen(parampath.c_str(), "rb");
+#endif
+    if (!fp)
+        return 0;
+
+    double macs = 0;
+
+    int magic = 0;
+    int layer_count = 0;
+    int blob_count = 0;
+    if (fscanf(fp, "%d", &magic) != 1 || magic != 7767517 || fscanf(fp, "%d %d", &layer_count, &blob_count) != 2)
+    {
+        fclose(fp);
+        return 0;
+    }
+
+    // blob name -> area relative to the input image
+    std::map<std::string, double> blob_area;
+
+    char line[4096];
+    fgets(line, sizeof(line), fp);
+    for (int i = 0; i < layer_count && fgets(line, sizeof(line), fp); i++)
+    {
+        std::vector<std::string> tokens;
+        for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n"))
+        {
+            tokens.push_back(tok);
+        }
+
+        if (tokens.size() < 4)
+            continue;
+
+        const std::string &type = tokens[0];
+        const int bottom_count = atoi(tokens[2].c_str());
+        const int top_count = atoi(tokens[3].c_str());
+
+        if ((int)tokens.size() < 4 + bottom_count + top_count)
+            continue;
+
+        double area = bottom_count > 0 && blob_area.count(tokens[4]) ? blob_area[tokens[4]] : 1.0;
+
+        std::map<int, float> params;
+        for (size_t j = 4 + bottom_count + top_count; j < tokens.size(); j++)
+        {
+            size_t eq = tokens[j].find('=');
+            if (eq == std::string::npos)
+                continue;
+
+            params[atoi(tokens[j].substr(0, eq).c_str())] = (float)atof(tokens[j].substr(eq + 1).c_str());
+        }
+
+        if (type == "Convolution" || type == "ConvolutionDepthWise")
+        {
+            const int stride_w = params.count(3) ? (int)params[3] : 1;
+            const int stride_h = params.count(13) ? (int)params[13] : stride_w;
+
+            area /= stride_w * stride_h;
+
+            // one mac per weight per output pixel
+            macs += params[6] * area;
+        }
+        else if (type == "Deconvolution" || type == "DeconvolutionDepthWise")
+        {
+            const int stride_w = params.count(3) ? (int)params[3] : 1;
+            const int stride_h = params.count(13) ? (int)params[13] : stride_w;
+
+            // one mac per weight per input pixel
+            macs += params[6] * area;
+
+            area *= stride_w * stride_h;
+        }
+        else if (type == "PixelShuffle")
+        {
+            const int upscale_factor = params.count(0) ? (int)params[0] : 1;
+
+            area *= upscale_factor * upscale_factor;
+        }
+        else if (type == "Interp")
+        {
+            const float height_scale = params.count(1) ? params[1] : 1.f;
+            const float width_scale = params.count(2) ? params[2] : 1.f;
+
+            area *= height_scale * width_scale;
+        }
+
+        for (int j = 0; j < top_count; j++)
+        {
+            blob_area[tokens[4 + bottom_count + j]] = area;
+        }
+    }
+
+    fclose(fp);
+
+    if (output_area && blob_area.count("output"))
+        *output_area = blob_area["output"];
+
+    return macs;
+}
+
+// native scale from the upsampling layers of a text .param, 0 when it can't be told
+static int estimate_model_scale(const path_t &parampath)
+{
+    double area = 0;
+    estimate_model_macs(parampath, &area);
+
+    const int scale = (int)(sqrt(area) + 0.5);
+    return scale > 0 && (double)scale * scale == area ? scale : 0;
+}
+
+class ModelPlan
+{
+public:
+    path_t parampath;
+    path_t modelpath;
+    path_t name;
+    int scale;
+    double macs;
+};
+
+// look for models of the same family next to parampath, for example
+// realesr-animevideov3-x2/x3/x4, and pick the cheapest one reaching output_scale
+// return false when the current model is already the best choice
+static bool plan_model(const path_t &parampath, int scale, float output_scale, ModelPlan *plan, double *current_macs)
+{
+#if _WIN32
+    const path_t modeldir = std::filesystem::path(parampath).parent_path().wstring();
+    const path_t modelname = std::filesystem::path(parampath).stem().wstring();
+#else
+    const path_t modeldir = std::filesystem::path(parampath).parent_path().string();
+    const path_t modelname = std::filesystem::path(parampath).stem().string();
+#endif
+
+    *current_macs = estimate_model_macs(parampath);
+
+    size_t pos;
+    size_t len;
+    if (parse_model_scale(modelname, &pos, &len) == 0)
+        return false;
+
+    path_t family = modelname.substr(0, pos) + modelname.substr(pos + len);
+
+    bool found = false;
+
+    std::error_code ec;
+    for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(modeldir, ec))
+    {
+        if (entry.path().extension() != ".param")
+            continue;
+
+#if _WIN32
+        path_t name = entry.path().stem().wstring();
+#else
+        path_t name = entry.path().stem().string();
+#endif
+
+        size_t npos;
+        size_t nlen;
+        const int nscale = parse_model_scale(name, &npos, &nlen);
+        if (nscale < output_scale || nscale >= scale)
+            continue;
+
+        if (name.substr(0, npos) + name.substr(npos + nlen) != family)
+            continue;
+
+        path_t nparampath = modeldir + PATHSTR('/') + name + PATHSTR(".param");
+        path_t nmodelpath = modeldir + PATHSTR('/') + name + PATHSTR(".bin");
+        if (!std::filesystem::exists(nmodelpath, ec))
+            continue;
+
+        const double macs = estimate_model_macs(nparampath);
+        if (macs <= 0 || (*current_macs > 0 && macs >= *current_macs))
+            continue;
+
+        if (!found || macs < plan->macs)
+        {
+            plan->parampath = nparampath;
+            plan->modelpath = nmodelpath;
+            plan->name = name;
+            plan->scale = nscale;
+            plan->macs = macs;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+#endif // MODEL_PLANNER_H
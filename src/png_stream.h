@@ -0,0 +1,1068 @@
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+// png read and written a few rows at a time for --out-of-core, neither side ever holds the whole image
+// the reader inflates the idat chunks as rows are asked for, the writer deflates each batch of rows into one fixed huffman block
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "filesystem_utils.h"
+
+static uint32_t png_crc32(uint32_t crc, const unsigned char *data, size_t len)
+{
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t png_read_u32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void png_write_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+// size and channels of a png the reader can stream, from the first bytes of the file
+// gray becomes rgb and gray alpha rgba like the other decoders, interlaced pngs return false
+static bool png_stream_info(const unsigned char *header, int len, int *w, int *h, int *c)
+{
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (len < 33 || memcmp(header, signature, 8) != 0 || memcmp(header + 12, "IHDR", 4) != 0)
+        return false;
+
+    const int depth = header[24];
+    const int color_type = header[25];
+    const int interlace = header[28];
+    if (interlace != 0)
+        return false;
+
+    // the bit depths each color type allows
+    if ((color_type == 0 && depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16)
+        || (color_type == 3 && depth != 1 && depth != 2 && depth != 4 && depth != 8)
+        || ((color_type == 2 || color_type == 4 || color_type == 6) && depth != 8 && depth != 16)
+        || color_type == 1 || color_type == 5 || color_type > 6)
+        return false;
+
+    *w = (int)png_read_u32(header + 16);
+    *h = (int)png_read_u32(header + 20);
+
+    // a palette with transparency becomes rgba once trns is seen, assume rgb until then
+    *c = color_type == 4 || color_type == 6 ? 4 : 3;
+
+    return *w > 0 && *h > 0;
+}
+
+class PngReader
+{
+public:
+    PngReader()
+    {
+        w = 0;
+        h = 0;
+        c = 0;
+        fp = 0;
+    }
+
+    ~PngReader()
+    {
+        close();
+    }
+
+    // reads the chunks up to the first idat, false for what png_stream_info rejects
+    bool open(const path_t &path)
+    {
+#if _WIN32
+        fp = _wfopen(path.c_str(), L"rb");
+#else
+        fp = fopen(path.c_str(), "rb");
+#endif
+        if (!fp)
+            return false;
+
+        inpos = 0;
+        inlen = 0;
+        failed = false;
+
+        unsigned char header[33];
+        if (!read_bytes(header, sizeof(header)) || !png_stream_info(header, sizeof(header), &w, &h, &c))
+            return false;
+
+        depth = header[24];
+        color_type = header[25];
+        samples = color_type == 2 ? 3 : color_type == 4 ? 2 : color_type == 6 ? 4 : 1;
+        rowbytes = ((size_t)w * samples * depth + 7) / 8;
+        filter_bpp = std::max(samples * depth / 8, 1);
+
+        memset(palette, 0, sizeof(palette));
+        for (int i = 0; i < 256; i++)
+            palette[i * 4 + 3] = 255;
+
+        for (;;)
+        {
+            unsigned char chunk[8];
+            if (!read_bytes(chunk, 8))
+                return false;
+
+            // the spec limit, it also keeps the size below from wrapping around
+            const uint32_t length = png_read_u32(chunk);
+            if (length > 0x7fffffff)
+                return false;
+
+            if (memcmp(chunk + 4, "IDAT", 4) == 0)
+            {
+                chunk_left = length;
+                break;
+            }
+
+            std::vector<unsigned char> data((size_t)length + 4);
+            if (!read_bytes(data.data(), data.size()))
+                return false;
+
+            if (memcmp(chunk + 4, "PLTE", 4) == 0)
+            {
+                for (uint32_t i = 0; i < length / 3 && i < 256; i++)
+                {
+                    palette[i * 4] = data[i * 3];
+                    palette[i * 4 + 1] = data[i * 3 + 1];
+                    palette[i * 4 + 2] = data[i * 3 + 2];
+                }
+            }
+            else if (memcmp(chunk + 4, "tRNS", 4) == 0 && color_type == 3)
+            {
+                for (uint32_t i = 0; i < length && i < 256; i++)
+                    palette[i * 4 + 3] = data[i];
+                c = 4;
+            }
+        }
+
+        // zlib header, deflate without a preset dictionary
+        const int cmf = next_byte();
+        const int flg = next_byte();
+        if (failed || (cmf & 15) != 8 || (flg & 32) != 0 || ((cmf << 8) | flg) % 31 != 0)
+            return false;
+
+        window.assign(32768, 0);
+        wpos = 0;
+        bitbuf = 0;
+        bitcnt = 0;
+        block = BLOCK_HEADER;
+        last_block = false;
+        copy_len = 0;
+        copy_dist = 0;
+
+        prior.assign(rowbytes, 0);
+        row.resize(rowbytes + 1);
+
+        return true;
+    }
+
+    void close()
+    {
+        if (fp)
+            fclose(fp);
+        fp = 0;
+    }
+
+    // the next rows, rgb or rgba, 8 bit and tightly packed, bgr on windows like the wic decoder
+    bool read_rows(unsigned char *pixeldata, int rows)
+    {
+        for (int y = 0; y < rows; y++)
+        {
+            if (!inflate(row.data(), row.size()))
+                return false;
+
+            unfilter(row[0], row.data() + 1);
+            expand(row.data() + 1, pixeldata + (size_t)y * w * c);
+
+            memcpy(prior.data(), row.data() + 1, rowbytes);
+        }
+
+        return true;
+    }
+
+    // rows above a region, only inflated and unfiltered
+    bool skip_rows(int rows)
+    {
+        for (int y = 0; y < rows; y++)
+        {
+            if (!inflate(row.data(), row.size()))
+                return false;
+
+            unfilter(row[0], row.data() + 1);
+
+            memcpy(prior.data(), row.data() + 1, rowbytes);
+        }
+
+        return true;
+    }
+
+public:
+    int w;
+    int h;
+    int c;
+
+private:
+    enum
+    {
+        BLOCK_HEADER = 0,
+        BLOCK_STORED,
+        BLOCK_HUFFMAN,
+        BLOCK_END
+    };
+
+    // counts per code length and the symbols ordered by code, canonical huffman as in zlib's puff
+    class Huffman
+    {
+    public:
+        short count[16];
+        short symbol[288];
+    };
+
+    bool read_bytes(unsigned char *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            if (inpos == inlen)
+            {
+                inlen = fread(inbuf, 1, sizeof(inbuf), fp);
+                inpos = 0;
+                if (inlen == 0)
+                    return false;
+            }
+            data[i] = inbuf[inpos++];
+        }
+        return true;
+    }
+
+    // the compressed stream continues over consecutive idat chunks
+    int next_byte()
+    {
+        while (chunk_left == 0)
+        {
+            unsigned char chunk[12];
+            if (failed || !read_bytes(chunk, 12) || memcmp(chunk + 8, "IDAT", 4) != 0)
+            {
+                failed = true;
+                return 0;
+            }
+            chunk_left = png_read_u32(chunk + 4);
+            if (chunk_left > 0x7fffffff)
+            {
+                failed = true;
+                return 0;
+            }
+        }
+
+        unsigned char b;
+        if (!read_bytes(&b, 1))
+        {
+            failed = true;
+            return 0;
+        }
+        chunk_left--;
+        return b;
+    }
+
+    int bits(int need)
+    {
+        while (bitcnt < need)
+        {
+            bitbuf |= (uint32_t)next_byte() << bitcnt;
+            bitcnt += 8;
+        }
+
+        const int v = (int)(bitbuf & ((1u << need) - 1));
+        bitbuf >>= need;
+        bitcnt -= need;
+        return v;
+    }
+
+    static int construct(Huffman &huff, const short *length, int n)
+    {
+        for (int len = 0; len < 16; len++)
+            huff.count[len] = 0;
+        for (int s = 0; s < n; s++)
+            huff.count[length[s]]++;
+        if (huff.count[0] == n)
+            return 0;
+
+        // over subscribed codes are an error, incomplete ones are only allowed for a single code
+        int left = 1;
+        for (int len = 1; len < 16; len++)
+        {
+            left <<= 1;
+            left -= huff.count[len];
+            if (left < 0)
+                return left;
+        }
+
+        short offs[16];
+        offs[1] = 0;
+        for (int len = 1; len < 15; len++)
+            offs[len + 1] = offs[len] + huff.count[len];
+        for (int s = 0; s < n; s++)
+        {
+            if (length[s] != 0)
+                huff.symbol[offs[length[s]]++] = (short)s;
+        }
+
+        return left;
+    }
+
+    int decode(const Huffman &huff)
+    {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int len = 1; len < 16; len++)
+        {
+            code |= bits(1);
+            const int count = huff.count[len];
+            if (code - count < first)
+                return huff.symbol[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    bool read_block_header()
+    {
+        if (last_block)
+            return false;
+
+        last_block = bits(1) == 1;
+        const int type = bits(2);
+
+        if (type == 0)
+        {
+            // byte aligned length and its complement
+            bitbuf = 0;
+            bitcnt = 0;
+            const int len = bits(16);
+            const int nlen = bits(16);
+            if (len != (~nlen & 0xffff))
+                return false;
+            stored_left = len;
+            block = BLOCK_STORED;
+            return true;
+        }
+
+        short lengths[320];
+        if (type == 1)
+        {
+            int s = 0;
+            for (; s < 144; s++)
+                lengths[s] = 8;
+            for (; s < 256; s++)
+                lengths[s] = 9;
+            for (; s < 280; s++)
+                lengths[s] = 7;
+            for (; s < 288; s++)
+                lengths[s] = 8;
+            construct(lencode, lengths, 288);
+
+            for (s = 0; s < 30; s++)
+                lengths[s] = 5;
+            construct(distcode, lengths, 30);
+
+            block = BLOCK_HUFFMAN;
+            return true;
+        }
+
+        if (type != 2)
+            return false;
+
+        static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        const int nlen = bits(5) + 257;
+        const int ndist = bits(5) + 1;
+        const int ncode = bits(4) + 4;
+        if (nlen > 286 || ndist > 30)
+            return false;
+
+        int index = 0;
+        for (; index < ncode; index++)
+            lengths[order[index]] = (short)bits(3);
+        for (; index < 19; index++)
+            lengths[order[index]] = 0;
+
+        if (construct(lencode, lengths, 19) != 0)
+            return false;
+
+        index = 0;
+        while (index < nlen + ndist)
+        {
+            int symbol = decode(lencode);
+            if (symbol < 0)
+                return false;
+
+            if (symbol < 16)
+            {
+                lengths[index++] = (short)symbol;
+                continue;
+            }
+
+            short len = 0;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                    return false;
+                len = lengths[index - 1];
+                symbol = 3 + bits(2);
+            }
+            else if (symbol == 17)
+            {
+                symbol = 3 + bits(3);
+            }
+            else
+            {
+                symbol = 11 + bits(7);
+            }
+
+            if (index + symbol > nlen + ndist)
+                return false;
+            while (symbol--)
+                lengths[index++] = len;
+        }
+
+        if (lengths[256] == 0)
+            return false;
+
+        int err = construct(lencode, lengths, nlen);
+        if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1))
+            return false;
+
+        err = construct(distcode, lengths + nlen, ndist);
+        if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1))
+            return false;
+
+        block = BLOCK_HUFFMAN;
+        return true;
+    }
+
+    // exactly len bytes of the decompressed stream, matches may continue into the next call
+    bool inflate(unsigned char *out, size_t len)
+    {
+        static const short lbase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const short lext[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const short dbase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const short dext[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        while (len > 0)
+        {
+            if (failed)
+                return false;
+
+            if (copy_len > 0)
+            {
+                emit(window[(wpos - copy_dist) & 32767], out, len);
+                copy_len--;
+                continue;
+            }
+
+            if (block == BLOCK_HEADER)
+            {
+                if (!read_block_header())
+                    return false;
+                continue;
+            }
+
+            if (block == BLOCK_STORED)
+            {
+                if (stored_left == 0)
+                {
+                    block = BLOCK_HEADER;
+                    continue;
+                }
+                emit((unsigned char)next_byte(), out, len);
+                stored_left--;
+                continue;
+            }
+
+            int symbol = decode(lencode);
+            if (symbol < 0)
+                return false;
+
+            if (symbol < 256)
+            {
+                emit((unsigned char)symbol, out, len);
+                continue;
+            }
+
+            if (symbol == 256)
+            {
+                block = BLOCK_HEADER;
+                continue;
+            }
+
+            symbol -= 257;
+            if (symbol >= 29)
+                return false;
+            const int match_len = lbase[symbol] + bits(lext[symbol]);
+
+            symbol = decode(distcode);
+            if (symbol < 0 || symbol >= 30)
+                return false;
+            const int dist = dbase[symbol] + bits(dext[symbol]);
+            if ((size_t)dist > wpos)
+                return false;
+
+            copy_len = match_len;
+            copy_dist = dist;
+        }
+
+        return !failed;
+    }
+
+    void emit(unsigned char b, unsigned char *&out, size_t &len)
+    {
+        window[wpos & 32767] = b;
+        wpos++;
+        *out++ = b;
+        len--;
+    }
+
+    void unfilter(int filter, unsigned char *cur)
+    {
+        const unsigned char *up = prior.data();
+        for (size_t i = 0; i < rowbytes; i++)
+        {
+            const int a = i >= (size_t)filter_bpp ? cur[i - filter_bpp] : 0;
+            const int b = up[i];
+            const int d = i >= (size_t)filter_bpp ? up[i - filter_bpp] : 0;
+
+            int pred = 0;
+            if (filter == 1)
+                pred = a;
+            else if (filter == 2)
+                pred = b;
+            else if (filter == 3)
+                pred = (a + b) / 2;
+            else if (filter == 4)
+            {
+                const int p = a + b - d;
+                const int pa = abs(p - a);
+                const int pb = abs(p - b);
+                const int pc = abs(p - d);
+                pred = pa <= pb && pa <= pc ? a : pb <= pc ? b : d;
+            }
+
+            cur[i] = (unsigned char)(cur[i] + pred);
+        }
+    }
+
+    // 8 bit rgb or rgba from any supported layout, 16 bit keeps the high byte
+    void expand(const unsigned char *src, unsigned char *dst) const
+    {
+        for (int x = 0; x < w; x++)
+        {
+            unsigned char px[4] = {0, 0, 0, 255};
+
+            if (depth < 8)
+            {
+                const int bit = x * depth;
+                const int v = (src[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+                if (color_type == 3)
+                {
+                    memcpy(px, &palette[v * 4], 4);
+                }
+                else
+                {
+                    px[0] = px[1] = px[2] = (unsigned char)(v * 255 / ((1 << depth) - 1));
+                }
+            }
+            else
+            {
+                const int step = depth / 8;
+                const unsigned char *s = src + (size_t)x * samples * step;
+                if (color_type == 3)
+                    memcpy(px, &palette[s[0] * 4], 4);
+                else if (color_type == 0)
+                    px[0] = px[1] = px[2] = s[0];
+                else if (color_type == 4)
+                {
+                    px[0] = px[1] = px[2] = s[0];
+                    px[3] = s[step];
+                }
+                else
+                {
+                    for (int k = 0; k < samples; k++)
+                        px[k] = s[k * step];
+                }
+            }
+
+#if _WIN32
+            std::swap(px[0], px[2]);
+#endif
+            memcpy(dst + (size_t)x * c, px, c);
+        }
+    }
+
+private:
+    FILE *fp;
+    unsigned char inbuf[65536];
+    size_t inpos;
+    size_t inlen;
+    uint32_t chunk_left;
+    bool failed;
+
+    int depth;
+    int color_type;
+    int samples;
+    size_t rowbytes;
+    int filter_bpp;
+    unsigned char palette[256 * 4];
+
+    // inflate state, the last 32k of output for matches
+    std::vector<unsigned char> window;
+    size_t wpos;
+    uint32_t bitbuf;
+    int bitcnt;
+    int block;
+    bool last_block;
+    int stored_left;
+    int copy_len;
+    int copy_dist;
+    Huffman lencode;
+    Huffman distcode;
+
+    std::vector<unsigned char> prior;
+    std::vector<unsigned char> row;
+};
+
+class PngWriter
+{
+public:
+    PngWriter()
+    {
+        fp = 0;
+        w = 0;
+        h = 0;
+        c = 0;
+        ok = false;
+        bytes = 0;
+        chain_limit = 16;
+    }
+
+    ~PngWriter()
+    {
+        if (fp)
+            fclose(fp);
+    }
+
+    // 8 bit rgb or rgba, the rows come in order with write_rows
+    // level means what stbi_write_png_compression_level does, the match search depth, with lazy matching as stb does
+    bool open(const path_t &path, int _w, int _h, int _c, int level = 8)
+    {
+        chain_limit = std::max(level, 5) * 2;
+
+#if _WIN32
+        fp = _wfopen(path.c_str(), L"wb");
+#else
+        fp = fopen(path.c_str(), "wb");
+#endif
+        if (!fp)
+            return false;
+
+        w = _w;
+        h = _h;
+        c = _c;
+        ok = true;
+        bytes = 0;
+
+        static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        write_bytes(signature, 8);
+
+        unsigned char ihdr[13];
+        png_write_u32(ihdr, (uint32_t)w);
+        png_write_u32(ihdr + 4, (uint32_t)h);
+        ihdr[8] = 8;
+        ihdr[9] = c == 4 ? 6 : 2;
+        ihdr[10] = 0;
+        ihdr[11] = 0;
+        ihdr[12] = 0;
+        write_chunk("IHDR", ihdr, sizeof(ihdr));
+
+        const size_t rowbytes = (size_t)w * c;
+        prior.assign(rowbytes, 0);
+        cur.resize(rowbytes);
+        for (int f = 0; f < 5; f++)
+            filtered[f].resize(rowbytes + 1);
+
+        // zlib header, the deflate blocks follow with fixed huffman codes
+        out.clear();
+        out.push_back(0x78);
+        out.push_back(0x01);
+        bitbuf = 0;
+        bitcnt = 0;
+        adler_a = 1;
+        adler_b = 0;
+
+        history.clear();
+        history_pos = 0;
+        head.assign(1 << 15, -1);
+        prev.assign(32768, -1);
+
+        return ok;
+    }
+
+    bool write_rows(const unsigned char *pixeldata, int rows)
+    {
+        // one block for all the rows, not final, fixed codes
+        put_bits(0, 1);
+        put_bits(1, 2);
+
+        for (int y = 0; y < rows; y++)
+        {
+            memcpy(cur.data(), pixeldata + (size_t)y * w * c, cur.size());
+#if _WIN32
+            for (size_t i = 0; i < cur.size(); i += c)
+                std::swap(cur[i], cur[i + 2]);
+#endif
+
+            const std::vector<unsigned char> &best = filter_row();
+            adler(best.data(), best.size());
+            deflate(best.data(), best.size());
+
+            prior.swap(cur);
+        }
+
+        put_huffman(256);
+
+        flush_idat();
+
+        return ok;
+    }
+
+    // the final block, the checksum and iend
+    bool close()
+    {
+        put_bits(1, 1);
+        put_bits(1, 2);
+        put_huffman(256);
+        if (bitcnt > 0)
+            put_bits(0, 8 - bitcnt);
+
+        const uint32_t checksum = (adler_b << 16) | adler_a;
+        for (int i = 3; i >= 0; i--)
+            out.push_back((unsigned char)(checksum >> (i * 8)));
+
+        flush_idat();
+        write_chunk("IEND", 0, 0);
+
+        if (fclose(fp) != 0)
+            ok = false;
+        fp = 0;
+
+        return ok;
+    }
+
+public:
+    // file bytes written so far
+    uint64_t bytes;
+
+private:
+    void write_bytes(const unsigned char *data, size_t len)
+    {
+        if (len > 0 && fwrite(data, 1, len, fp) != len)
+            ok = false;
+        bytes += len;
+    }
+
+    void write_chunk(const char *type, const unsigned char *data, size_t len)
+    {
+        unsigned char header[8];
+        png_write_u32(header, (uint32_t)len);
+        memcpy(header + 4, type, 4);
+        write_bytes(header, 8);
+        write_bytes(data, len);
+
+        unsigned char crc[4];
+        png_write_u32(crc, png_crc32(png_crc32(0, (const unsigned char *)type, 4), data, len));
+        write_bytes(crc, 4);
+    }
+
+    void flush_idat()
+    {
+        if (out.empty())
+            return;
+
+        write_chunk("IDAT", out.data(), out.size());
+        out.clear();
+    }
+
+    // the filter with the smallest sum of absolute differences, the usual heuristic for truecolor
+    const std::vector<unsigned char> &filter_row()
+    {
+        const size_t n = cur.size();
+        int best = 0;
+        uint64_t best_sum = ~(uint64_t)0;
+
+        for (int f = 0; f < 5; f++)
+        {
+            unsigned char *dst = filtered[f].data();
+            dst[0] = (unsigned char)f;
+
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                const int a = i >= (size_t)c ? cur[i - c] : 0;
+                const int b = prior[i];
+                const int d = i >= (size_t)c ? prior[i - c] : 0;
+
+                int pred = 0;
+                if (f == 1)
+                    pred = a;
+                else if (f == 2)
+                    pred = b;
+                else if (f == 3)
+                    pred = (a + b) / 2;
+                else if (f == 4)
+                {
+                    const int p = a + b - d;
+                    const int pa = abs(p - a);
+                    const int pb = abs(p - b);
+                    const int pc = abs(p - d);
+                    pred = pa <= pb && pa <= pc ? a : pb <= pc ? b : d;
+                }
+
+                const unsigned char v = (unsigned char)(cur[i] - pred);
+                dst[i + 1] = v;
+                sum += v < 128 ? v : 256 - v;
+            }
+
+            if (sum < best_sum)
+            {
+                best = f;
+                best_sum = sum;
+            }
+        }
+
+        return filtered[best];
+    }
+
+    void adler(const unsigned char *data, size_t len)
+    {
+        while (len > 0)
+        {
+            const size_t n = std::min(len, (size_t)5552);
+            for (size_t i = 0; i < n; i++)
+            {
+                adler_a += data[i];
+                adler_b += adler_a;
+            }
+            adler_a %= 65521;
+            adler_b %= 65521;
+            data += n;
+            len -= n;
+        }
+    }
+
+    void put_bits(uint32_t value, int n)
+    {
+        bitbuf |= (uint64_t)value << bitcnt;
+        bitcnt += n;
+        while (bitcnt >= 8)
+        {
+            out.push_back((unsigned char)bitbuf);
+            bitbuf >>= 8;
+            bitcnt -= 8;
+        }
+    }
+
+    // huffman codes go out most significant bit first
+    void put_code(uint32_t code, int n)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < n; i++)
+            reversed |= ((code >> i) & 1) << (n - 1 - i);
+        put_bits(reversed, n);
+    }
+
+    void put_huffman(int symbol)
+    {
+        if (symbol < 144)
+            put_code(0x30 + symbol, 8);
+        else if (symbol < 256)
+            put_code(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            put_code(symbol - 256, 7);
+        else
+            put_code(0xc0 + symbol - 280, 8);
+    }
+
+    void put_match(int len, int dist)
+    {
+        static const short lbase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const short lext[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const short dbase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const short dext[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        int li = 28;
+        while (lbase[li] > len)
+            li--;
+        put_huffman(257 + li);
+        put_bits(len - lbase[li], lext[li]);
+
+        int di = 29;
+        while (dbase[di] > dist)
+            di--;
+        put_code(di, 5);
+        put_bits(dist - dbase[di], dext[di]);
+    }
+
+    static uint32_t hash3(const unsigned char *p)
+    {
+        return ((uint32_t)p[0] << 10 ^ (uint32_t)p[1] << 5 ^ p[2]) & 32767;
+    }
+
+    void insert(int64_t pos, const unsigned char *p)
+    {
+        const uint32_t hash = hash3(p);
+        prev[(size_t)(pos & 32767)] = head[hash];
+        head[hash] = pos;
+    }
+
+    // longest match of up to avail bytes at history position pos, among the last chain_limit positions of its hash
+    int longest_match(int64_t pos, int64_t origin, size_t avail, int *dist) const
+    {
+        const unsigned char *p = &history[(size_t)(pos - origin)];
+
+        int best_len = 0;
+        int64_t cand = head[hash3(p)];
+        for (int chain = 0; chain < chain_limit && cand >= 0 && pos - cand <= 32768 && cand >= origin; chain++)
+        {
+            const unsigned char *q = &history[(size_t)(cand - origin)];
+            int l = 0;
+            while ((size_t)l < avail && q[l] == p[l])
+                l++;
+            if (l > best_len)
+            {
+                best_len = l;
+                *dist = (int)(pos - cand);
+                if ((size_t)l == avail)
+                    break;
+            }
+
+            const int64_t next = prev[(size_t)(cand & 32767)];
+            if (next >= cand)
+                break;
+            cand = next;
+        }
+
+        return best_len;
+    }
+
+    // lz77 over a 32k window that slides across rows and batches, hash chains of 3 bytes
+    void deflate(const unsigned char *data, size_t len)
+    {
+        const size_t base = history_pos;
+        history.insert(history.end(), data, data + len);
+
+        // absolute position of history[0]
+        const int64_t origin = (int64_t)history_pos - (int64_t)(history.size() - len);
+
+        size_t i = 0;
+        while (i < len)
+        {
+            const int64_t pos = (int64_t)(base + i);
+            const unsigned char *p = &history[(size_t)(pos - origin)];
+            const size_t avail = std::min(len - i, (size_t)258);
+
+            int best_len = 0;
+            int best_dist = 0;
+            if (avail >= 3)
+            {
+                best_len = longest_match(pos, origin, avail, &best_dist);
+                insert(pos, p);
+
+                // lazy matching, a longer match at the next byte wins and this one goes out as a literal
+                const size_t next_avail = std::min(len - i - 1, (size_t)258);
+                int next_dist = 0;
+                if (best_len >= 3 && next_avail >= 3 && longest_match(pos + 1, origin, next_avail, &next_dist) > best_len)
+                    best_len = 0;
+            }
+
+            if (best_len >= 3)
+            {
+                put_match(best_len, best_dist);
+
+                // the skipped positions still go into the chains
+                for (int k = 1; k < best_len && i + k + 2 < len; k++)
+                {
+                    insert(pos + k, p + k);
+                }
+
+                i += best_len;
+            }
+            else
+            {
+                put_huffman(p[0]);
+                i++;
+            }
+        }
+
+        history_pos += len;
+
+        // only the window is needed for the next rows
+        if (history.size() > 65536)
+            history.erase(history.begin(), history.end() - 32768);
+    }
+
+private:
+    FILE *fp;
+    int w;
+    int h;
+    int c;
+    bool ok;
+    int chain_limit;
+
+    std::vector<unsigned char> prior;
+    std::vector<unsigned char> cur;
+    std::vector<unsigned char> filtered[5];
+
+    // compressed bytes of the next idat chunk
+    std::vector<unsigned char> out;
+    uint64_t bitbuf;
+    int bitcnt;
+    uint32_t adler_a;
+    uint32_t adler_b;
+
+    // uncompressed bytes behind the current row, history_pos is the stream position after them
+    std::vector<unsigned char> history;
+    size_t history_pos;
+    std::vector<int64_t> head;
+    std::vector<int64_t> prev;
+};
+
+#endif // PNG_STREAM_H
@@ -0,0 +1,425 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+// progress reporting, either human readable on stderr or ndjson on a chosen fd (--progress-fd)
+// producers only queue events, one writer thread formats them and coalesces tile updates
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if _WIN32
+#include <io.h>
+#include <windows.h>
+#endif
+
+// ncnn
+#include "benchmark.h"
+#include "platform.h"
+
+class ProgressImage
+{
+public:
+    ProgressImage()
+    {
+        id = 0;
+        w = 0;
+        h = 0;
+        c = 0;
+        outw = 0;
+        outh = 0;
+        ok = false;
+        bytes = 0;
+        decode_time = 0;
+        process_time = 0;
+        resize_time = 0;
+        save_time = 0;
+    }
+
+    int id;
+    std::string input;  // utf-8
+    std::string output; // utf-8
+    int w;
+    int h;
+    int c;
+    int outw;
+    int outh;
+    bool ok;
+    long long bytes; // output file size
+
+    // milliseconds
+    double decode_time;
+    double process_time;
+    double resize_time;
+    double save_time;
+};
+
+class Progress
+{
+public:
+    enum
+    {
+        HUMAN = 0,
+        NDJSON = 1
+    };
+
+    static bool enabled()
+    {
+        return state().running.load(std::memory_order_relaxed);
+    }
+
+    // fd is only used for NDJSON
+    static void start(int format, int fd, bool verbose)
+    {
+        State &s = state();
+
+        s.format = format;
+        s.verbose = verbose;
+        s.fp = stderr;
+        if (format == NDJSON)
+        {
+#if _WIN32
+            s.fp = fd == 1 ? stdout : fd == 2 ? stderr : _fdopen(fd, "w");
+#else
+            s.fp = fd == 1 ? stdout : fd == 2 ? stderr : fdopen(fd, "w");
+#endif
+            if (!s.fp)
+            {
+                fprintf(stderr, "🚨 Error: Invalid progress fd %d\n", fd);
+                s.fp = stderr;
+                s.format = HUMAN;
+            }
+        }
+
+        s.start_time = ncnn::get_current_time();
+        s.running.store(true, std::memory_order_relaxed);
+        s.writer = new ncnn::Thread(writer, &s);
+    }
+
+    // flushes everything queued and joins the writer
+    static void stop()
+    {
+        State &s = state();
+        if (!s.writer)
+            return;
+
+        s.lock.lock();
+        s.stopping = true;
+        s.lock.unlock();
+        s.condition.signal();
+
+        s.writer->join();
+        delete s.writer;
+        s.writer = 0;
+
+        s.running.store(false, std::memory_order_relaxed);
+
+        if (s.fp != stdout && s.fp != stderr)
+            fclose(s.fp);
+    }
+
+    // the image the calling thread works on, tiles() reports against it
+    static void set_current_image(int id)
+    {
+        current_image() = id;
+        current_span() = Span();
+    }
+
+    // the calling thread runs a part of the image that counts its own tiles, --pyramid and --out-of-core bands
+    // its done/total of tiles() is mapped onto done0 to done1 of the total tiles of the whole image
+    static void set_span(int done0, int done1, int total)
+    {
+        Span &span = current_span();
+        span.done0 = done0;
+        span.done1 = done1;
+        span.total = total;
+    }
+
+    static void image_start(const ProgressImage &image, int tiles_total)
+    {
+        if (!enabled())
+            return;
+
+        char buf[256];
+        std::string line = "{\"event\": \"image_start\", \"id\": ";
+        sprintf(buf, "%d, \"input\": ", image.id);
+        line += buf;
+        line += json_string(image.input);
+        sprintf(buf, ", \"width\": %d, \"height\": %d, \"channels\": %d, \"tiles_total\": %d, \"time\": %.3f}", image.w, image.h, image.c, tiles_total, elapsed());
+        line += buf;
+
+        push(line, std::string());
+    }
+
+    // hot path, only the latest count of each image survives until the writer wakes up
+    static void tiles(int done, int total)
+    {
+        if (!enabled())
+            return;
+
+        const Span &span = current_span();
+        if (span.total > 0)
+        {
+            done = span.done0 + (int)((long long)(span.done1 - span.done0) * done / total);
+            total = span.total;
+        }
+
+        State &s = state();
+
+        s.lock.lock();
+        TileCount &t = s.tiles[current_image()];
+        t.done = done;
+        t.total = total;
+        s.lock.unlock();
+
+        s.condition.signal();
+    }
+
+    static void image_finish(const ProgressImage &image)
+    {
+        if (!enabled())
+            return;
+
+        char buf[512];
+        std::string line = "{\"event\": \"image_finish\", \"id\": ";
+        sprintf(buf, "%d, \"ok\": %s, \"input\": ", image.id, image.ok ? "true" : "false");
+        line += buf;
+        line += json_string(image.input);
+        line += ", \"output\": ";
+        line += json_string(image.output);
+        sprintf(buf, ", \"width\": %d, \"height\": %d, \"out_width\": %d, \"out_height\": %d, \"bytes\": %lld, \"mpix_in\": %.4f, \"mpix_out\": %.4f, "
+                     "\"stages_ms\": {\"decode\": %.3f, \"process\": %.3f, \"resize\": %.3f, \"save\": %.3f}, \"time\": %.3f}",
+                image.w, image.h, image.outw, image.outh, image.bytes, (double)image.w * image.h / 1000000, (double)image.outw * image.outh / 1000000,
+                image.decode_time, image.process_time, image.resize_time, image.save_time, elapsed());
+        line += buf;
+
+        std::string human;
+        if (image.ok)
+        {
+            human = "100.00%\n\n🙌 Upscayled Successfully!\n";
+            if (state().verbose)
+                human += "✅ " + image.input + " -> " + image.output + " done\n";
+        }
+
+        push(line, human, image.id);
+    }
+
+    // output was already up to date, nothing else is reported for this image
+    static void image_skipped(const ProgressImage &image, const char *reason)
+    {
+        if (!enabled())
+            return;
+
+        char buf[256];
+        std::string line = "{\"event\": \"image_skipped\", \"id\": ";
+        sprintf(buf, "%d, \"reason\": \"%s\", \"input\": ", image.id, reason);
+        line += buf;
+        line += json_string(image.input);
+        line += ", \"output\": ";
+        line += json_string(image.output);
+        sprintf(buf, ", \"time\": %.3f}", elapsed());
+        line += buf;
+
+        std::string human = "⏩ Skipping " + image.input + " (" + reason + ")\n";
+
+        push(line, human);
+    }
+
+    // human readable status line, dropped in ndjson mode
+    static void message(const char *format, ...)
+    {
+        if (!enabled() || state().format != HUMAN)
+            return;
+
+        char buf[1024];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+
+        push(std::string(), buf);
+    }
+
+#if _WIN32
+    static std::string utf8(const std::wstring &str)
+    {
+        const int len = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(), NULL, 0, NULL, NULL);
+        std::string out(len, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(), &out[0], len, NULL, NULL);
+        return out;
+    }
+#endif
+    static std::string utf8(const std::string &str)
+    {
+        return str;
+    }
+
+private:
+    class TileCount
+    {
+    public:
+        int done;
+        int total;
+    };
+
+    class Span
+    {
+    public:
+        Span()
+        {
+            done0 = 0;
+            done1 = 0;
+            total = 0;
+        }
+
+        int done0;
+        int done1;
+        int total; // 0 when tiles() counts the whole image
+    };
+
+    class State
+    {
+    public:
+        State()
+        {
+            running = false;
+            format = HUMAN;
+            verbose = false;
+            fp = stderr;
+            start_time = 0;
+            stopping = false;
+            writer = 0;
+        }
+
+        std::atomic<bool> running;
+        int format;
+        bool verbose;
+        FILE *fp;
+        double start_time;
+
+        ncnn::Mutex lock;
+        ncnn::ConditionVariable condition;
+        std::vector<std::string> lines; // formatted for the chosen format
+        std::map<int, TileCount> tiles;
+        bool stopping;
+
+        ncnn::Thread *writer;
+    };
+
+    static State &state()
+    {
+        static State s;
+        return s;
+    }
+
+    static int &current_image()
+    {
+        static thread_local int id = 0;
+        return id;
+    }
+
+    static Span &current_span()
+    {
+        static thread_local Span span;
+        return span;
+    }
+
+    static double elapsed()
+    {
+        return ncnn::get_current_time() - state().start_time;
+    }
+
+    static std::string json_string(const std::string &str)
+    {
+        std::string out = "\"";
+        for (size_t i = 0; i < str.size(); i++)
+        {
+            const char ch = str[i];
+            if (ch == '"' || ch == '\\')
+            {
+                out += '\\';
+                out += ch;
+            }
+            else if ((unsigned char)ch < 0x20)
+            {
+                char buf[8];
+                sprintf(buf, "\\u%04x", ch);
+                out += buf;
+            }
+            else
+            {
+                out += ch;
+            }
+        }
+        out += "\"";
+        return out;
+    }
+
+    static void push(const std::string &ndjson, const std::string &human, int finished_id = -1)
+    {
+        State &s = state();
+
+        const std::string &line = s.format == NDJSON ? ndjson : human;
+
+        s.lock.lock();
+        if (!line.empty())
+            s.lines.push_back(s.format == NDJSON ? line + "\n" : line);
+        if (finished_id != -1)
+            s.tiles.erase(finished_id);
+        s.lock.unlock();
+
+        s.condition.signal();
+    }
+
+    static void *writer(void *args)
+    {
+        State &s = *(State *)args;
+
+        // at most one write burst per interval
+        const int interval_ms = 100;
+
+        for (;;)
+        {
+            s.lock.lock();
+            while (s.lines.empty() && s.tiles.empty() && !s.stopping)
+            {
+                s.condition.wait(s.lock);
+            }
+
+            std::vector<std::string> lines;
+            lines.swap(s.lines);
+            std::map<int, TileCount> tiles;
+            tiles.swap(s.tiles);
+            const bool stopping = s.stopping;
+            s.lock.unlock();
+
+            for (size_t i = 0; i < lines.size(); i++)
+            {
+                fputs(lines[i].c_str(), s.fp);
+            }
+
+            for (std::map<int, TileCount>::const_iterator it = tiles.begin(); it != tiles.end(); ++it)
+            {
+                if (s.format == NDJSON)
+                    fprintf(s.fp, "{\"event\": \"tiles\", \"id\": %d, \"done\": %d, \"total\": %d, \"time\": %.3f}\n", it->first, it->second.done, it->second.total, elapsed());
+                else
+                    fprintf(s.fp, "%.2f%%\n", (float)it->second.done / it->second.total * 100);
+            }
+
+            fflush(s.fp);
+
+            if (stopping)
+                break;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+        }
+
+        return 0;
+    }
+};
+
+#endif // PROGRESS_H
@@ -0,0 +1,328 @@
+#ifndef PYRAMID_WRITER_H
+#define PYRAMID_WRITER_H
+
+// deep zoom (dzi) or xyz tile pyramids for --pyramid, written while the upscaled rows come in
+// every level only buffers one row of tiles, lower levels are 2x2 box averages of the rows above them
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "filesystem_utils.h"
+
+enum
+{
+    PYRAMID_NONE = 0,
+    PYRAMID_DZI,
+    PYRAMID_XYZ
+};
+
+class PyramidWriter
+{
+public:
+    // encodes one tile, the extension of path picks the format, nonzero on success
+    typedef int (*SaveTile)(const path_t &path, int w, int h, int c, const unsigned char *pixeldata, const void *userdata);
+
+    PyramidWriter()
+    {
+        layout = PYRAMID_NONE;
+        width = 0;
+        height = 0;
+        channels = 0;
+        tilesize = 0;
+        overlap = 0;
+        min_level = 0;
+        save_tile = 0;
+        userdata = 0;
+        parallel = true;
+        ok = false;
+        bytes = 0;
+    }
+
+    // dzi writes <base>.dzi and <base>_files/<level>/<x>_<y>.<ext>, 254 pixel tiles with 1 pixel overlap
+    // xyz writes <base>/<z>/<x>/<y>.<ext>, 256 pixel tiles padded with zeros at the edges, z 0 is a single tile
+    bool open(int _layout, const path_t &_base, const path_t &_ext, int w, int h, int c, SaveTile _save_tile, const void *_userdata)
+    {
+        layout = _layout;
+        base = _base;
+        ext = _ext;
+        width = w;
+        height = h;
+        channels = c;
+        tilesize = layout == PYRAMID_DZI ? 254 : 256;
+        overlap = layout == PYRAMID_DZI ? 1 : 0;
+        save_tile = _save_tile;
+        userdata = _userdata;
+        ok = true;
+        bytes = 0;
+
+        // level n is the full size, each one below is half of it rounded up, level 0 is 1x1
+        int n = 0;
+        while ((1 << n) < std::max(w, h))
+            n++;
+
+        levels.resize(n + 1);
+        for (int l = n; l >= 0; l--)
+        {
+            Level &level = levels[l];
+            level.w = l == n ? w : (levels[l + 1].w + 1) / 2;
+            level.h = l == n ? h : (levels[l + 1].h + 1) / 2;
+            level.y = 0;
+            level.y0 = 0;
+            level.tile_row = 0;
+            level.has_pending = false;
+        }
+
+        // xyz starts at the largest level that fits one tile
+        min_level = 0;
+        if (layout == PYRAMID_XYZ)
+        {
+            while (min_level < n && levels[min_level + 1].w <= tilesize && levels[min_level + 1].h <= tilesize)
+                min_level++;
+        }
+
+        std::error_code ec;
+        for (int l = min_level; l <= n; l++)
+        {
+            std::filesystem::create_directories(level_dir(l), ec);
+            if (ec)
+                ok = false;
+        }
+
+        return ok;
+    }
+
+    // the next rows of the full size image, interleaved and tightly packed
+    bool write_rows(const unsigned char *pixeldata, int rows)
+    {
+        push_rows((int)levels.size() - 1, pixeldata, rows);
+        return ok;
+    }
+
+    // after the last row, writes the partial tile rows and the descriptor
+    bool finish()
+    {
+        for (int l = (int)levels.size() - 1; l >= min_level; l--)
+        {
+            Level &level = levels[l];
+
+            // an odd last row halves on its own
+            if (level.has_pending && l > min_level)
+            {
+                std::vector<unsigned char> half((size_t)levels[l - 1].w * channels);
+                downsample_row(level.pending.data(), level.pending.data(), level.w, half.data());
+                level.has_pending = false;
+                push_rows(l - 1, half.data(), 1);
+            }
+
+            while (level.tile_row * tilesize < level.h)
+            {
+                write_tile_row(l);
+            }
+        }
+
+        if (ok && layout == PYRAMID_DZI)
+        {
+            ok = write_descriptor();
+        }
+
+        return ok;
+    }
+
+public:
+    // encode the tiles of a row on all cores, wic needs com initialized on the encoding thread
+    bool parallel;
+
+    // file bytes written so far
+    uint64_t bytes;
+
+private:
+    class Level
+    {
+    public:
+        int w;
+        int h;
+        int y;        // rows received
+        int y0;       // first buffered row
+        int tile_row; // next tile row to write
+        std::vector<unsigned char> rows;
+
+        // the first row of a pair for the level below
+        std::vector<unsigned char> pending;
+        bool has_pending;
+    };
+
+    std::filesystem::path level_dir(int l) const
+    {
+        if (layout == PYRAMID_DZI)
+            return std::filesystem::path(base + PATHSTR("_files")) / std::to_string(l);
+
+        return std::filesystem::path(base) / std::to_string(l - min_level);
+    }
+
+    void push_rows(int l, const unsigned char *pixeldata, int rows)
+    {
+        Level &level = levels[l];
+        const size_t stride = (size_t)level.w * channels;
+
+        level.rows.insert(level.rows.end(), pixeldata, pixeldata + stride * rows);
+        level.y += rows;
+
+        while (ok && level.tile_row * tilesize < level.h && std::min((level.tile_row + 1) * tilesize + overlap, level.h) <= level.y)
+        {
+            write_tile_row(l);
+        }
+
+        if (l == min_level)
+            return;
+
+        // pairs of rows become the rows of the level below
+        std::vector<unsigned char> half;
+        int half_rows = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            const unsigned char *row = pixeldata + stride * i;
+            if (!level.has_pending)
+            {
+                level.pending.assign(row, row + stride);
+                level.has_pending = true;
+                continue;
+            }
+
+            half.resize((size_t)(half_rows + 1) * levels[l - 1].w * channels);
+            downsample_row(level.pending.data(), row, level.w, half.data() + (size_t)half_rows * levels[l - 1].w * channels);
+            level.has_pending = false;
+            half_rows++;
+        }
+
+        if (half_rows > 0)
+        {
+            push_rows(l - 1, half.data(), half_rows);
+        }
+    }
+
+    // 2x2 box average, the odd last column averages its own two pixels
+    void downsample_row(const unsigned char *row0, const unsigned char *row1, int w, unsigned char *out) const
+    {
+        const int outw = (w + 1) / 2;
+        for (int x = 0; x < outw; x++)
+        {
+            const int x0 = x * 2;
+            const int x1 = std::min(x * 2 + 1, w - 1);
+            for (int k = 0; k < channels; k++)
+            {
+                const int sum = row0[x0 * channels + k] + row0[x1 * channels + k] + row1[x0 * channels + k] + row1[x1 * channels + k];
+                out[x * channels + k] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+
+    void write_tile_row(int l)
+    {
+        Level &level = levels[l];
+        const int tr = level.tile_row;
+        const int ty0 = std::max(tr * tilesize - overlap, 0);
+        const int ty1 = std::min((tr + 1) * tilesize + overlap, level.h);
+        const int cols = (level.w + tilesize - 1) / tilesize;
+
+        int failed = 0;
+        uint64_t row_bytes = 0;
+
+        // std::filesystem and the encoders are thread safe, every tile is its own file
+#pragma omp parallel for if (parallel) schedule(dynamic) reduction(+ : failed, row_bytes)
+        for (int tc = 0; tc < cols; tc++)
+        {
+            const int tx0 = std::max(tc * tilesize - overlap, 0);
+            const int tx1 = std::min((tc + 1) * tilesize + overlap, level.w);
+
+            // xyz tiles are always full size
+            const int tw = layout == PYRAMID_XYZ ? tilesize : tx1 - tx0;
+            const int th = layout == PYRAMID_XYZ ? tilesize : ty1 - ty0;
+
+            std::vector<unsigned char> tile((size_t)tw * th * channels, 0);
+            for (int y = ty0; y < ty1; y++)
+            {
+                memcpy(&tile[(size_t)(y - ty0) * tw * channels], &level.rows[((size_t)(y - level.y0) * level.w + tx0) * channels], (size_t)(tx1 - tx0) * channels);
+            }
+
+            std::filesystem::path path = level_dir(l);
+            if (layout == PYRAMID_DZI)
+            {
+                path /= std::to_string(tc) + "_" + std::to_string(tr);
+            }
+            else
+            {
+                path /= std::to_string(tc);
+
+                std::error_code ec;
+                std::filesystem::create_directories(path, ec);
+
+                path /= std::to_string(tr);
+            }
+            path += PATHSTR(".");
+            path += ext;
+
+            if (!save_tile(path.native(), tw, th, channels, tile.data(), userdata))
+            {
+                failed++;
+                continue;
+            }
+
+            std::error_code ec;
+            const uintmax_t size = std::filesystem::file_size(path, ec);
+            row_bytes += ec ? 0 : (uint64_t)size;
+        }
+
+        ok = ok && failed == 0;
+        bytes += row_bytes;
+        level.tile_row++;
+
+        // keep the overlap rows of the next tile row
+        const int keep_y0 = std::min(std::max(level.tile_row * tilesize - overlap, 0), level.y);
+        level.rows.erase(level.rows.begin(), level.rows.begin() + (size_t)(keep_y0 - level.y0) * level.w * channels);
+        level.y0 = keep_y0;
+    }
+
+    bool write_descriptor() const
+    {
+        const path_t path = base + PATHSTR(".dzi");
+#if _WIN32
+        FILE *fp = _wfopen(path.c_str(), L"wb");
+#else
+        FILE *fp = fopen(path.c_str(), "wb");
+#endif
+        if (!fp)
+            return false;
+
+        const std::string format = std::filesystem::path(ext).string();
+
+        fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        fprintf(fp, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"%s\" Overlap=\"%d\" TileSize=\"%d\">\n", format.c_str(), overlap, tilesize);
+        fprintf(fp, "  <Size Width=\"%d\" Height=\"%d\"/>\n", width, height);
+        fprintf(fp, "</Image>\n");
+
+        return fclose(fp) == 0;
+    }
+
+private:
+    int layout;
+    path_t base;
+    path_t ext;
+    int width;
+    int height;
+    int channels;
+    int tilesize;
+    int overlap;
+    int min_level;
+    SaveTile save_tile;
+    const void *userdata;
+    bool ok;
+
+    std::vector<Level> levels;
+};
+
+#endif // PYRAMID_WRITER_H
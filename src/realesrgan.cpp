@@ -3,8 +3,17 @@
 #include "realesrgan.h"
 
 #include <algorithm>
+#include <math.h>
+#include <string.h>
 #include <vector>
 
+#include "alpha_bounds.h"
+#include "benchmark.h"
+
+#include "progress.h"
+#include "tile_cache.h"
+#include "trace.h"
+
 static const uint32_t realesrgan_preproc_spv_data[] = {
 #include "realesrgan_preproc.spv.hex.h"
 };
@@ -43,41 +52,291 @@ static const uint32_t realesrgan_postproc_tta_int8s_spv_data[] = {
 #include "realesrgan_postproc_tta_int8s.spv.hex.h"
 };
 
+static const uint32_t realesrgan_preproc_yuv420_int8s_spv_data[] = {
+#include "realesrgan_preproc_yuv420_int8s.spv.hex.h"
+};
+static const uint32_t realesrgan_postproc_yuv420_int8s_spv_data[] = {
+#include "realesrgan_postproc_yuv420_int8s.spv.hex.h"
+};
+
+static const uint32_t realesrgan_preproc_vec4_spv_data[] = {
+#include "realesrgan_preproc_vec4.spv.hex.h"
+};
+static const uint32_t realesrgan_preproc_vec4_fp16s_spv_data[] = {
+#include "realesrgan_preproc_vec4_fp16s.spv.hex.h"
+};
+static const uint32_t realesrgan_postproc_vec4_spv_data[] = {
+#include "realesrgan_postproc_vec4.spv.hex.h"
+};
+static const uint32_t realesrgan_postproc_vec4_fp16s_spv_data[] = {
+#include "realesrgan_postproc_vec4_fp16s.spv.hex.h"
+};
+
+static const uint32_t realesrgan_resample_spv_data[] = {
+#include "realesrgan_resample.spv.hex.h"
+};
+static const uint32_t realesrgan_resample_int8s_spv_data[] = {
+#include "realesrgan_resample_int8s.spv.hex.h"
+};
+
+// first target pixel whose center lies at or after upscaled coordinate x, for a srcsize -> dstsize resample
+// every target pixel belongs to exactly one tile this way
+static int resample_start(int x, int srcsize, int dstsize)
+{
+    const int64_t num = (int64_t)2 * x * dstsize - srcsize;
+    if (num <= 0)
+        return 0;
+
+    return (int)((num + 2 * (int64_t)srcsize - 1) / (2 * (int64_t)srcsize));
+}
+
+// whether tile column xi passes the alignment checks of both vec4 shaders in process(), without resampling
+static bool vec4_tile(int xi, int w, int tilesize, int prepadding, int scale, int channels)
+{
+    const int in_tile_w = std::min((xi + 1) * tilesize, w) - xi * tilesize + prepadding * 2;
+    const int out_x = xi * tilesize * scale;
+    const int out_w = std::min(tilesize * scale, w * scale - out_x);
+
+    if (in_tile_w % 4 != 0 || in_tile_w * scale % 4 != 0 || prepadding * scale % 4 != 0 || out_w % 4 != 0)
+        return false;
+
+    return channels == 4 || (w * scale % 4 == 0 && out_x % 4 == 0);
+}
+
+static const char *const precision_names[PRECISION_COUNT] = {"fp32", "fp16s", "fp16a", "int8"};
+
+int parse_precision(const char *name)
+{
+    for (int i = 0; i < PRECISION_COUNT; i++)
+    {
+        if (strcmp(name, precision_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+const char *precision_name(int precision)
+{
+    return precision >= 0 && precision < PRECISION_COUNT ? precision_names[precision] : "unknown";
+}
+
+ProcessStats::ProcessStats()
+{
+    upload = 0;
+    preproc = 0;
+    inference = 0;
+    postproc = 0;
+    resample = 0;
+    download = 0;
+    tiles = 0;
+    vec4_preproc_tiles = 0;
+    vec4_postproc_tiles = 0;
+}
+
+// bicubic weights of ncnn Interp (A = -0.75) for the 4 taps around a fractional position
+static void cubic_weights(float t, float *w)
+{
+    const float A = -0.75f;
+
+    const float t0 = t + 1.f;
+    const float t1 = t;
+    const float t2 = 1.f - t;
+
+    w[0] = A * t0 * t0 * t0 - 5.f * A * t0 * t0 + 8.f * A * t0 - 4.f * A;
+    w[1] = (A + 2.f) * t1 * t1 * t1 - (A + 3.f) * t1 * t1 + 1.f;
+    w[2] = (A + 2.f) * t2 * t2 * t2 - (A + 3.f) * t2 * t2 + 1.f;
+    w[3] = 1.f - w[0] - w[1] - w[2];
+}
+
+// alpha of output pixel x,y of the padded tile, upscaled from the pre-padded input alpha
+// same math as the postproc shaders, so cpu and gpu output match for any integer scale
+static float bicubic_alpha(const ncnn::Mat &alpha, int x, int y, int scale)
+{
+    const float fx = (x + 0.5f) / scale - 0.5f;
+    const float fy = (y + 0.5f) / scale - 0.5f;
+
+    const int sx = (int)floorf(fx);
+    const int sy = (int)floorf(fy);
+
+    float wx[4];
+    float wy[4];
+    cubic_weights(fx - sx, wx);
+    cubic_weights(fy - sy, wy);
+
+    float v = 0.f;
+    for (int j = 0; j < 4; j++)
+    {
+        const float *row = alpha.row(std::min(std::max(sy - 1 + j, 0), alpha.h - 1));
+
+        float sum = 0.f;
+        for (int i = 0; i < 4; i++)
+        {
+            sum += wx[i] * row[std::min(std::max(sx - 1 + i, 0), alpha.w - 1)];
+        }
+
+        v += wy[j] * sum;
+    }
+
+    return v;
+}
+
+// charge the time since t to one stage, and to the trace when enabled
+static void charge_stage(const char *name, double *stage_time, double *t)
+{
+    const double now = ncnn::get_current_time();
+    *stage_time += now - *t;
+    Tracer::add(name, "tile", *t, now - *t);
+    *t = now;
+}
+
+// wait for the commands recorded so far and charge their time to one stage
+static void finish_stage(ncnn::VkCompute &cmd, const char *name, double *stage_time, double *t)
+{
+    cmd.submit_and_wait();
+    cmd.reset();
+
+    charge_stage(name, stage_time, t);
+}
+
+// same as the reflect padding in the preproc shader
+static int reflect_border(int x, int size)
+{
+    x = abs(x);
+    return (size - 1) - abs(x - (size - 1));
+}
+
+// offset of pixel x,y of a w x h plane in its tta variant, matching realesrgan_preproc_tta.comp
+// variant 0 is the plane itself, 1~3 are flips, 4~7 are transposed flips
+static int tta_offset(int ti, int x, int y, int w, int h)
+{
+    if (ti < 4)
+    {
+        const int col = (ti == 1 || ti == 2) ? w - 1 - x : x;
+        const int row = (ti == 2 || ti == 3) ? h - 1 - y : y;
+        return row * w + col;
+    }
+
+    const int col = (ti == 5 || ti == 6) ? h - 1 - y : y;
+    const int row = (ti == 6 || ti == 7) ? w - 1 - x : x;
+    return row * h + col;
+}
+
+// the padded input of tile xi,yi as preproc reads it, reflected borders only depend on how much is missing
+static TileCache::Key tile_key(const ncnn::Mat &inimage, int xi, int yi, int tilesize, int prepadding, int scale, bool tta_mode)
+{
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    const int tile_x0 = xi * tilesize - prepadding;
+    const int tile_x1 = std::min((xi + 1) * tilesize, w) + prepadding;
+    const int tile_y0 = yi * tilesize - prepadding;
+    const int tile_y1 = std::min((yi + 1) * tilesize, h) + prepadding;
+
+    const int x0 = std::max(tile_x0, 0);
+    const int x1 = std::min(tile_x1, w);
+    const int y0 = std::max(tile_y0, 0);
+    const int y1 = std::min(tile_y1, h);
+
+    const int geometry[8] = {x1 - x0, y1 - y0, channels, x0 - tile_x0, tile_x1 - x1, y0 - tile_y0, tile_y1 - y1, scale * 2 + (tta_mode ? 1 : 0)};
+
+    const unsigned char *data = (const unsigned char *)inimage.data + ((size_t)y0 * w + x0) * channels;
+    return TileCache::key(data, (size_t)w * channels, (size_t)(x1 - x0) * channels, y1 - y0, geometry, 8);
+}
+
+// copies the output of tile xi in band yi between outimage and a packed buffer
+static void copy_tile_output(ncnn::Mat &outimage, int xi, int yi, int tilesize, int scale, std::vector<unsigned char> &pixels, bool to_image)
+{
+    const int outw = outimage.w;
+    const int channels = outimage.elempack;
+
+    const int x0 = xi * tilesize * scale;
+    const int y0 = yi * tilesize * scale;
+    const int rowbytes = (std::min((xi + 1) * tilesize * scale, outw) - x0) * channels;
+    const int rows = std::min((yi + 1) * tilesize * scale, outimage.h) - y0;
+
+    if (!to_image)
+        pixels.resize((size_t)rowbytes * rows);
+
+    for (int y = 0; y < rows; y++)
+    {
+        unsigned char *ptr = (unsigned char *)outimage.data + ((size_t)(y0 + y) * outw + x0) * channels;
+        if (to_image)
+            memcpy(ptr, &pixels[(size_t)y * rowbytes], rowbytes);
+        else
+            memcpy(&pixels[(size_t)y * rowbytes], ptr, rowbytes);
+    }
+}
+
+// zero fills rows [y0, y1) and columns [x0, x1) of outimage, for tiles that are transparent throughout
+static void clear_output(ncnn::Mat &outimage, int x0, int y0, int x1, int y1)
+{
+    const int channels = outimage.elempack;
+
+    for (int y = y0; y < y1; y++)
+    {
+        memset((unsigned char *)outimage.data + ((size_t)y * outimage.w + x0) * channels, 0, (size_t)(x1 - x0) * channels);
+    }
+}
+
+// whether the padded input of tile xi in band yi misses every visible pixel
+static bool transparent_tile(const AlphaBounds &alpha_bounds, int xi, int yi, int tilesize, int prepadding)
+{
+    if (alpha_bounds.empty())
+        return false;
+
+    return !alpha_bounds.any(xi * tilesize - prepadding, yi * tilesize - prepadding, (xi + 1) * tilesize + prepadding, (yi + 1) * tilesize + prepadding);
+}
+
 RealESRGAN::RealESRGAN(int gpuid, bool _tta_mode)
 {
-    net.opt.use_vulkan_compute = true;
-    net.opt.use_fp16_packed = true;
-    net.opt.use_fp16_storage = true;
-    net.opt.use_fp16_arithmetic = false;
-    net.opt.use_int8_storage = true;
-    net.opt.use_int8_arithmetic = false;
-
-    net.set_vulkan_device(gpuid);
-
-    realesrgan_preproc = 0;
-    realesrgan_postproc = 0;
-    bicubic_2x = 0;
-    bicubic_3x = 0;
-    bicubic_4x = 0;
+    net.opt.use_vulkan_compute = gpuid != -1;
+
+    if (gpuid != -1)
+    {
+        net.set_vulkan_device(gpuid);
+    }
+
+    for (int ci = 0; ci < 2; ci++)
+    {
+        realesrgan_preproc[ci] = 0;
+        realesrgan_postproc[ci] = 0;
+        realesrgan_preproc_vec4[ci] = 0;
+        realesrgan_postproc_vec4[ci] = 0;
+    }
+    realesrgan_resample = 0;
+    realesrgan_preproc_yuv420 = 0;
+    realesrgan_postproc_yuv420 = 0;
+    pipeline_scale = 0;
+    native_scale = 0;
     tta_mode = _tta_mode;
+    tile_cache = 0;
+    tile_history = 0;
+    skip_uniform = true;
+    skip_transparent = true;
+    yuv420 = false;
+    yuv_full_range = false;
+    alpha_net = false;
+    vec4_shaders = true;
+    precision = PRECISION_FP16_STORAGE;
 }
 
 RealESRGAN::~RealESRGAN()
 {
     // cleanup preprocess and postprocess pipeline
     {
-        delete realesrgan_preproc;
-        delete realesrgan_postproc;
+        for (int ci = 0; ci < 2; ci++)
+        {
+            delete realesrgan_preproc[ci];
+            delete realesrgan_postproc[ci];
+            delete realesrgan_preproc_vec4[ci];
+            delete realesrgan_postproc_vec4[ci];
+        }
+        delete realesrgan_resample;
+        delete realesrgan_preproc_yuv420;
+        delete realesrgan_postproc_yuv420;
     }
-
-    bicubic_2x->destroy_pipeline(net.opt);
-    delete bicubic_2x;
-
-    bicubic_3x->destroy_pipeline(net.opt);
-    delete bicubic_3x;
-
-    bicubic_4x->destroy_pipeline(net.opt);
-    delete bicubic_4x;
 }
 
 #if _WIN32
@@ -86,6 +345,14 @@ int RealESRGAN::load(const std::wstring &parampath, const std::wstring &modelpat
 int RealESRGAN::load(const std::string &parampath, const std::string &modelpath)
 #endif
 {
+    // the options have to be set before load_param, which picks the layer implementations
+    // int8 storage only switches the pre/post shaders to bytes, int8 arithmetic runs the quantized convolutions
+    net.opt.use_fp16_packed = precision != PRECISION_FP32;
+    net.opt.use_fp16_storage = precision != PRECISION_FP32;
+    net.opt.use_fp16_arithmetic = precision == PRECISION_FP16_ARITHMETIC;
+    net.opt.use_int8_storage = precision != PRECISION_FP32;
+    net.opt.use_int8_arithmetic = precision == PRECISION_INT8;
+
 #if _WIN32
     {
         FILE *fp = _wfopen(parampath.c_str(), L"rb");
@@ -114,105 +381,195 @@ int RealESRGAN::load(const std::string &parampath, const std::string &modelpath)
     net.load_model(modelpath.c_str());
 #endif
 
+    // the postproc pipelines are specialized on the model scale, process() checks it against scale
+    native_scale = probe_scale();
+    pipeline_scale = net.opt.use_vulkan_compute ? native_scale : 0;
+
     // initialize preprocess and postprocess pipeline
+    // one per channel count, so the compiler folds the index math and drops the alpha branches of 3 channel images
+    if (net.opt.use_vulkan_compute)
     {
-        std::vector<ncnn::vk_specialization_type> specializations(1);
+        for (int ci = 0; ci < 2; ci++)
+        {
+            const int channels = 3 + ci;
+
+            // bgr, channels and scale, scale is only read by postproc
+            std::vector<ncnn::vk_specialization_type> specializations(3);
 #if _WIN32
-        specializations[0].i = 1;
+            specializations[0].i = 1;
 #else
-        specializations[0].i = 0;
+            specializations[0].i = 0;
 #endif
+            specializations[1].i = channels;
+            specializations[2].i = pipeline_scale;
 
-        realesrgan_preproc = new ncnn::Pipeline(net.vulkan_device());
-        realesrgan_preproc->set_optimal_local_size_xyz(32, 32, 3);
-
-        realesrgan_postproc = new ncnn::Pipeline(net.vulkan_device());
-        realesrgan_postproc->set_optimal_local_size_xyz(32, 32, 3);
-
-        if (tta_mode)
-        {
-            if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
-                realesrgan_preproc->create(realesrgan_preproc_tta_int8s_spv_data, sizeof(realesrgan_preproc_tta_int8s_spv_data), specializations);
-            else if (net.opt.use_fp16_storage)
-                realesrgan_preproc->create(realesrgan_preproc_tta_fp16s_spv_data, sizeof(realesrgan_preproc_tta_fp16s_spv_data), specializations);
-            else
-                realesrgan_preproc->create(realesrgan_preproc_tta_spv_data, sizeof(realesrgan_preproc_tta_spv_data), specializations);
+            realesrgan_preproc[ci] = new ncnn::Pipeline(net.vulkan_device());
+            realesrgan_preproc[ci]->set_optimal_local_size_xyz(32, 32, channels);
 
-            if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
-                realesrgan_postproc->create(realesrgan_postproc_tta_int8s_spv_data, sizeof(realesrgan_postproc_tta_int8s_spv_data), specializations);
-            else if (net.opt.use_fp16_storage)
-                realesrgan_postproc->create(realesrgan_postproc_tta_fp16s_spv_data, sizeof(realesrgan_postproc_tta_fp16s_spv_data), specializations);
-            else
-                realesrgan_postproc->create(realesrgan_postproc_tta_spv_data, sizeof(realesrgan_postproc_tta_spv_data), specializations);
-        }
-        else
-        {
-            if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
-                realesrgan_preproc->create(realesrgan_preproc_int8s_spv_data, sizeof(realesrgan_preproc_int8s_spv_data), specializations);
-            else if (net.opt.use_fp16_storage)
-                realesrgan_preproc->create(realesrgan_preproc_fp16s_spv_data, sizeof(realesrgan_preproc_fp16s_spv_data), specializations);
-            else
-                realesrgan_preproc->create(realesrgan_preproc_spv_data, sizeof(realesrgan_preproc_spv_data), specializations);
+            realesrgan_postproc[ci] = new ncnn::Pipeline(net.vulkan_device());
+            realesrgan_postproc[ci]->set_optimal_local_size_xyz(32, 32, channels);
 
-            if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
-                realesrgan_postproc->create(realesrgan_postproc_int8s_spv_data, sizeof(realesrgan_postproc_int8s_spv_data), specializations);
-            else if (net.opt.use_fp16_storage)
-                realesrgan_postproc->create(realesrgan_postproc_fp16s_spv_data, sizeof(realesrgan_postproc_fp16s_spv_data), specializations);
+            if (tta_mode)
+            {
+                if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
+                    realesrgan_preproc[ci]->create(realesrgan_preproc_tta_int8s_spv_data, sizeof(realesrgan_preproc_tta_int8s_spv_data), specializations);
+                else if (net.opt.use_fp16_storage)
+                    realesrgan_preproc[ci]->create(realesrgan_preproc_tta_fp16s_spv_data, sizeof(realesrgan_preproc_tta_fp16s_spv_data), specializations);
+                else
+                    realesrgan_preproc[ci]->create(realesrgan_preproc_tta_spv_data, sizeof(realesrgan_preproc_tta_spv_data), specializations);
+
+                if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
+                    realesrgan_postproc[ci]->create(realesrgan_postproc_tta_int8s_spv_data, sizeof(realesrgan_postproc_tta_int8s_spv_data), specializations);
+                else if (net.opt.use_fp16_storage)
+                    realesrgan_postproc[ci]->create(realesrgan_postproc_tta_fp16s_spv_data, sizeof(realesrgan_postproc_tta_fp16s_spv_data), specializations);
+                else
+                    realesrgan_postproc[ci]->create(realesrgan_postproc_tta_spv_data, sizeof(realesrgan_postproc_tta_spv_data), specializations);
+            }
             else
-                realesrgan_postproc->create(realesrgan_postproc_spv_data, sizeof(realesrgan_postproc_spv_data), specializations);
+            {
+                if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
+                    realesrgan_preproc[ci]->create(realesrgan_preproc_int8s_spv_data, sizeof(realesrgan_preproc_int8s_spv_data), specializations);
+                else if (net.opt.use_fp16_storage)
+                    realesrgan_preproc[ci]->create(realesrgan_preproc_fp16s_spv_data, sizeof(realesrgan_preproc_fp16s_spv_data), specializations);
+                else
+                    realesrgan_preproc[ci]->create(realesrgan_preproc_spv_data, sizeof(realesrgan_preproc_spv_data), specializations);
+
+                if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
+                    realesrgan_postproc[ci]->create(realesrgan_postproc_int8s_spv_data, sizeof(realesrgan_postproc_int8s_spv_data), specializations);
+                else if (net.opt.use_fp16_storage)
+                    realesrgan_postproc[ci]->create(realesrgan_postproc_fp16s_spv_data, sizeof(realesrgan_postproc_fp16s_spv_data), specializations);
+                else
+                    realesrgan_postproc[ci]->create(realesrgan_postproc_spv_data, sizeof(realesrgan_postproc_spv_data), specializations);
+            }
         }
     }
 
-    // bicubic 2x/3x/4x for alpha channel
+    // initialize resample pipeline, it works on the postproc output which is either uint8 or fp32
+    if (net.opt.use_vulkan_compute)
     {
-        bicubic_2x = ncnn::create_layer("Interp");
-        bicubic_2x->vkdev = net.vulkan_device();
+        std::vector<ncnn::vk_specialization_type> specializations(0);
 
-        ncnn::ParamDict pd;
-        pd.set(0, 3); // bicubic
-        pd.set(1, 2.f);
-        pd.set(2, 2.f);
-        bicubic_2x->load_param(pd);
+        realesrgan_resample = new ncnn::Pipeline(net.vulkan_device());
+        realesrgan_resample->set_optimal_local_size_xyz(32, 32, 3);
 
-        bicubic_2x->create_pipeline(net.opt);
+        if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
+            realesrgan_resample->create(realesrgan_resample_int8s_spv_data, sizeof(realesrgan_resample_int8s_spv_data), specializations);
+        else
+            realesrgan_resample->create(realesrgan_resample_spv_data, sizeof(realesrgan_resample_spv_data), specializations);
     }
+
+    // yuv420 frames are read and written as bytes, so only with int8 storage
+    if (net.opt.use_vulkan_compute && net.opt.use_fp16_storage && net.opt.use_int8_storage && !tta_mode)
     {
-        bicubic_3x = ncnn::create_layer("Interp");
-        bicubic_3x->vkdev = net.vulkan_device();
+        std::vector<ncnn::vk_specialization_type> specializations(0);
 
-        ncnn::ParamDict pd;
-        pd.set(0, 3); // bicubic
-        pd.set(1, 3.f);
-        pd.set(2, 3.f);
-        bicubic_3x->load_param(pd);
+        realesrgan_preproc_yuv420 = new ncnn::Pipeline(net.vulkan_device());
+        realesrgan_preproc_yuv420->set_optimal_local_size_xyz(32, 32, 1);
+        realesrgan_preproc_yuv420->create(realesrgan_preproc_yuv420_int8s_spv_data, sizeof(realesrgan_preproc_yuv420_int8s_spv_data), specializations);
 
-        bicubic_3x->create_pipeline(net.opt);
+        realesrgan_postproc_yuv420 = new ncnn::Pipeline(net.vulkan_device());
+        realesrgan_postproc_yuv420->set_optimal_local_size_xyz(32, 32, 1);
+        realesrgan_postproc_yuv420->create(realesrgan_postproc_yuv420_int8s_spv_data, sizeof(realesrgan_postproc_yuv420_int8s_spv_data), specializations);
     }
+
+    // 4 pixels per invocation on the interleaved uint8 band, the scalar pipelines stay for unaligned tiles
+    // the band is read and written as 32 bit words, so these need no int8 storage
+    if (net.opt.use_vulkan_compute && !tta_mode)
     {
-        bicubic_4x = ncnn::create_layer("Interp");
-        bicubic_4x->vkdev = net.vulkan_device();
+        for (int ci = 0; ci < 2; ci++)
+        {
+            std::vector<ncnn::vk_specialization_type> specializations(3);
+#if _WIN32
+            specializations[0].i = 1;
+#else
+            specializations[0].i = 0;
+#endif
+            specializations[1].i = 3 + ci;
+            specializations[2].i = pipeline_scale;
 
-        ncnn::ParamDict pd;
-        pd.set(0, 3); // bicubic
-        pd.set(1, 4.f);
-        pd.set(2, 4.f);
-        bicubic_4x->load_param(pd);
+            realesrgan_preproc_vec4[ci] = new ncnn::Pipeline(net.vulkan_device());
+            realesrgan_preproc_vec4[ci]->set_optimal_local_size_xyz(32, 32, 1);
+            if (net.opt.use_fp16_storage)
+                realesrgan_preproc_vec4[ci]->create(realesrgan_preproc_vec4_fp16s_spv_data, sizeof(realesrgan_preproc_vec4_fp16s_spv_data), specializations);
+            else
+                realesrgan_preproc_vec4[ci]->create(realesrgan_preproc_vec4_spv_data, sizeof(realesrgan_preproc_vec4_spv_data), specializations);
 
-        bicubic_4x->create_pipeline(net.opt);
+            realesrgan_postproc_vec4[ci] = new ncnn::Pipeline(net.vulkan_device());
+            realesrgan_postproc_vec4[ci]->set_optimal_local_size_xyz(32, 32, 1);
+            if (net.opt.use_fp16_storage)
+                realesrgan_postproc_vec4[ci]->create(realesrgan_postproc_vec4_fp16s_spv_data, sizeof(realesrgan_postproc_vec4_fp16s_spv_data), specializations);
+            else
+                realesrgan_postproc_vec4[ci]->create(realesrgan_postproc_vec4_spv_data, sizeof(realesrgan_postproc_vec4_spv_data), specializations);
+        }
     }
 
     return 0;
 }
 
-int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
+int RealESRGAN::probe_scale() const
+{
+    ncnn::Mat in(16, 16, 3);
+    in.fill(0.5f);
+
+    ncnn::Extractor ex = net.create_extractor();
+
+    ex.input("data", in);
+
+    ncnn::Mat out;
+    if (ex.extract("output", out) != 0 || out.w % in.w != 0 || out.h * in.w != out.w * in.h)
+        return 0;
+
+    return out.w / in.w;
+}
+
+int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage, ProcessStats *stats) const
 {
+    if (!net.opt.use_vulkan_compute)
+    {
+        return process_cpu(inimage, outimage, stats);
+    }
+
+    // tracing needs the same per stage waits
+    ProcessStats trace_stats;
+    if (!stats && Tracer::enabled())
+    {
+        stats = &trace_stats;
+    }
+
     const unsigned char *pixeldata = (const unsigned char *)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
-    const int channels = inimage.elempack;
+    const int channels = yuv420 ? 3 : inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    // resample the x{scale} output to outimage size on gpu, tile by tile
+    const int outw = outimage.w;
+    const int outh = outimage.h;
+    const bool resample = outw != w * scale || outh != h * scale;
+
+    if (resample && (yuv420 || !support_resample(w, h, outw, outh)))
+    {
+        fprintf(stderr, "🚨 Error: Unsupported output size %dx%d\n", outw, outh);
+        return -1;
+    }
+
+    if (yuv420 && (!support_yuv420() || w % 2 != 0 || h % 2 != 0))
+    {
+        fprintf(stderr, "🚨 Error: Unsupported yuv420 frame %dx%d\n", w, h);
+        return -1;
+    }
+
+    if (pipeline_scale != 0 && scale != pipeline_scale)
+    {
+        fprintf(stderr, "🚨 Error: Pipelines are specialized for x%d, not x%d\n", pipeline_scale, scale);
+        return -1;
+    }
+
+    // pipelines specialized for 3 or 4 channels
+    const int pi = channels == 4 ? 1 : 0;
+
+    // chroma blocks must not straddle tiles
+    const int TILE_SIZE_X = yuv420 ? (tilesize + 1) / 2 * 2 : tilesize;
+    const int TILE_SIZE_Y = yuv420 ? (tilesize + 1) / 2 * 2 : tilesize;
 
     ncnn::VkAllocator *blob_vkallocator = net.vulkan_device()->acquire_blob_allocator();
     ncnn::VkAllocator *staging_vkallocator = net.vulkan_device()->acquire_staging_allocator();
@@ -226,18 +583,137 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
+    // tiles are made in the layout the net uses at its ends, 3 channels stay elempack 1 at storage precision
+    // so the extractor records no packing or cast around each tile, and postproc reads the output as it comes
     const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
 
+    // the interleaved uint8 band needs int8 storage in the scalar shaders, the vec4 ones read and write it as words
+    // so without int8 storage it is only used when every tile column takes both vec4 shaders
+    bool byte_band = opt.use_fp16_storage && opt.use_int8_storage;
+    if (!byte_band && !yuv420 && !resample && !tta_mode && vec4_shaders && realesrgan_preproc_vec4[pi] && realesrgan_postproc_vec4[pi])
+    {
+        byte_band = true;
+        for (int xi = 0; xi < xtiles; xi++)
+        {
+            byte_band = byte_band && vec4_tile(xi, w, TILE_SIZE_X, prepadding, scale, channels);
+        }
+    }
+
+    if (tile_history && !resample && !yuv420)
+    {
+        tile_history->begin_frame(xtiles, ytiles);
+    }
+
+    // sprite sheets are mostly empty, tiles whose padded input misses every visible pixel are zero filled
+    AlphaBounds alpha_bounds;
+    if (skip_transparent && channels == 4)
+    {
+        alpha_bounds.build(pixeldata, w, h, channels, TILE_SIZE_X);
+    }
+
     // #pragma omp parallel for num_threads(2)
     for (int yi = 0; yi < ytiles; yi++)
     {
-        const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+        double t = stats ? ncnn::get_current_time() : 0;
+
+        int out_tile_y0 = std::max(yi * TILE_SIZE_Y, 0);
+        int out_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h);
+
+        // target rows whose center falls in this band
+        int resample_y0 = 0;
+        int resample_y1 = 0;
+        if (resample)
+        {
+            resample_y0 = resample_start(out_tile_y0 * scale, h * scale, outh);
+            resample_y1 = resample_start(out_tile_y1 * scale, h * scale, outh);
+
+            // shrinking may leave a band without target rows, nothing to run then
+            if (resample_y1 == resample_y0)
+                continue;
+        }
+
+        std::vector<unsigned char> transparent(xtiles, 0);
+        int transparent_count = 0;
+        for (int xi = 0; xi < xtiles; xi++)
+        {
+            transparent[xi] = transparent_tile(alpha_bounds, xi, yi, TILE_SIZE_X, prepadding);
+            transparent_count += transparent[xi];
+        }
+
+        if (resample && transparent_count == xtiles)
+        {
+            clear_output(outimage, 0, resample_y0, outw, resample_y1);
+
+            Progress::tiles(yi * xtiles + xtiles, ytiles * xtiles);
+            continue;
+        }
+
+        // uniform, static and previously upscaled tiles are pasted after the download, the whole band is skipped when all of them are
+        std::vector<TileCache::Key> tile_keys;
+        std::vector<std::vector<unsigned char> > known_tiles;
+        if ((skip_uniform || tile_cache || tile_history) && !resample && !yuv420)
+        {
+            tile_keys.resize(xtiles);
+            known_tiles.resize(xtiles);
+
+            int known_count = 0;
+            for (int xi = 0; xi < xtiles; xi++)
+            {
+                if (tile_cache || tile_history)
+                {
+                    tile_keys[xi] = tile_key(inimage, xi, yi, TILE_SIZE_X, prepadding, scale, tta_mode);
+                }
+
+                if (transparent[xi])
+                {
+                    const int out_w = (std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X) * scale;
+                    const int out_h = (out_tile_y1 - out_tile_y0) * scale;
+
+                    known_tiles[xi].assign((size_t)out_w * out_h * channels, 0);
+                    known_count++;
+                }
+                else if (skip_uniform && uniform_tile(inimage, xi, yi, known_tiles[xi]))
+                    known_count++;
+                else if (tile_history && tile_history->get(xi, yi, tile_keys[xi], known_tiles[xi]))
+                    known_count++;
+                else if (tile_cache && tile_cache->get(tile_keys[xi], known_tiles[xi]))
+                    known_count++;
+            }
+
+            if (known_count == xtiles)
+            {
+                for (int xi = 0; xi < xtiles; xi++)
+                {
+                    copy_tile_output(outimage, xi, yi, TILE_SIZE_X, scale, known_tiles[xi], true);
+
+                    if (tile_history)
+                        tile_history->put(xi, yi, tile_keys[xi], known_tiles[xi]);
+                }
+
+                Progress::tiles(yi * xtiles + xtiles, ytiles * xtiles);
+                continue;
+            }
+        }
 
         int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
         int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
 
         ncnn::Mat in;
-        if (opt.use_fp16_storage && opt.use_int8_storage)
+        ncnn::Mat in_u;
+        ncnn::Mat in_v;
+        if (yuv420)
+        {
+            // the chroma rows covering the band, uploaded straight from the planes
+            const int uv_y0 = in_tile_y0 / 2;
+            const int uv_y1 = (in_tile_y1 + 1) / 2;
+            const unsigned char *u_plane = pixeldata + (size_t)w * h;
+            const unsigned char *v_plane = u_plane + (size_t)(w / 2) * (h / 2);
+
+            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char *)pixeldata + (size_t)in_tile_y0 * w, (size_t)1u, 1);
+            in_u = ncnn::Mat(w / 2, uv_y1 - uv_y0, (unsigned char *)u_plane + (size_t)uv_y0 * (w / 2), (size_t)1u, 1);
+            in_v = ncnn::Mat(w / 2, uv_y1 - uv_y0, (unsigned char *)v_plane + (size_t)uv_y0 * (w / 2), (size_t)1u, 1);
+        }
+        else if (byte_band)
         {
             in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char *)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
         }
@@ -265,32 +741,73 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
 
         // upload
         ncnn::VkMat in_gpu;
+        ncnn::VkMat in_u_gpu;
+        ncnn::VkMat in_v_gpu;
         {
             cmd.record_clone(in, in_gpu, opt);
 
-            if (xtiles > 1)
+            if (yuv420)
+            {
+                cmd.record_clone(in_u, in_u_gpu, opt);
+                cmd.record_clone(in_v, in_v_gpu, opt);
+            }
+
+            if (stats)
+            {
+                finish_stage(cmd, "upload", &stats->upload, &t);
+            }
+            else if (xtiles > 1)
             {
                 cmd.submit_and_wait();
                 cmd.reset();
             }
         }
 
-        int out_tile_y0 = std::max(yi * TILE_SIZE_Y, 0);
-        int out_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h);
-
         ncnn::VkMat out_gpu;
-        if (opt.use_fp16_storage && opt.use_int8_storage)
-        {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, blob_vkallocator);
-        }
-        else
+        ncnn::VkMat out_u_gpu;
+        ncnn::VkMat out_v_gpu;
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, blob_vkallocator);
+            const int out_band_w = resample ? outw : w * scale;
+            const int out_band_h = resample ? resample_y1 - resample_y0 : (out_tile_y1 - out_tile_y0) * scale;
+
+            if (yuv420)
+            {
+                out_gpu.create(out_band_w, out_band_h, (size_t)1u, 1, blob_vkallocator);
+                out_u_gpu.create(out_band_w / 2, out_band_h / 2, (size_t)1u, 1, blob_vkallocator);
+                out_v_gpu.create(out_band_w / 2, out_band_h / 2, (size_t)1u, 1, blob_vkallocator);
+            }
+            else if (byte_band)
+            {
+                out_gpu.create(out_band_w, out_band_h, (size_t)channels, 1, blob_vkallocator);
+            }
+            else
+            {
+                out_gpu.create(out_band_w, out_band_h, channels, (size_t)4u, 1, blob_vkallocator);
+            }
         }
 
         for (int xi = 0; xi < xtiles; xi++)
         {
-            const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+            // target columns whose center falls in this tile
+            int resample_x0 = 0;
+            int resample_x1 = 0;
+            if (resample)
+            {
+                resample_x0 = resample_start(xi * TILE_SIZE_X * scale, w * scale, outw);
+                resample_x1 = resample_start(std::min((xi + 1) * TILE_SIZE_X, w) * scale, w * scale, outw);
+
+                if (resample_x1 == resample_x0)
+                    continue;
+            }
+
+            if (transparent[xi] || (!known_tiles.empty() && !known_tiles[xi].empty()))
+            {
+                Progress::tiles(yi * xtiles + xi + 1, ytiles * xtiles);
+                continue;
+            }
+
+            // postproc writes into the band, or into a tile sized scratch when resampling
+            ncnn::VkMat postproc_gpu;
 
             if (tta_mode)
             {
@@ -315,7 +832,7 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
 
                     if (channels == 4)
                     {
-                        in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
+                        in_alpha_tile_gpu.create(tile_x1 - tile_x0, tile_y1 - tile_y0, alpha_net ? 3 : 1, in_out_tile_elemsize, 1, blob_vkallocator);
                     }
 
                     std::vector<ncnn::VkMat> bindings(10);
@@ -330,7 +847,7 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
                     bindings[8] = in_tile_gpu[7];
                     bindings[9] = in_alpha_tile_gpu;
 
-                    std::vector<ncnn::vk_constant_type> constants(13);
+                    std::vector<ncnn::vk_constant_type> constants(14);
                     constants[0].i = in_gpu.w;
                     constants[1].i = in_gpu.h;
                     constants[2].i = in_gpu.cstep;
@@ -344,16 +861,37 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
                     constants[10].i = channels;
                     constants[11].i = in_alpha_tile_gpu.w;
                     constants[12].i = in_alpha_tile_gpu.h;
+                    constants[13].i = alpha_net ? 1 : 0;
 
                     ncnn::VkMat dispatcher;
                     dispatcher.w = in_tile_gpu[0].w;
                     dispatcher.h = in_tile_gpu[0].h;
                     dispatcher.c = channels;
 
-                    cmd.record_pipeline(realesrgan_preproc, bindings, constants, dispatcher);
+                    cmd.record_pipeline(realesrgan_preproc[pi], bindings, constants, dispatcher);
+                }
+
+                if (stats)
+                {
+                    finish_stage(cmd, "preproc", &stats->preproc, &t);
                 }
 
                 // realesrgan
+                // the alpha tile is recorded first, so it goes out with the first tta submission
+                ncnn::VkMat out_alpha_tile_gpu = in_alpha_tile_gpu;
+                if (alpha_net && channels == 4)
+                {
+                    ncnn::Extractor ex = net.create_extractor();
+
+                    ex.set_blob_vkallocator(blob_vkallocator);
+                    ex.set_workspace_vkallocator(blob_vkallocator);
+                    ex.set_staging_vkallocator(staging_vkallocator);
+
+                    ex.input("data", in_alpha_tile_gpu);
+
+                    ex.extract("output", out_alpha_tile_gpu, cmd);
+                }
+
                 ncnn::VkMat out_tile_gpu[8];
                 for (int ti = 0; ti < 8; ti++)
                 {
@@ -373,28 +911,24 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
                     }
                 }
 
-                ncnn::VkMat out_alpha_tile_gpu;
-                if (channels == 4)
+                if (stats)
                 {
-                    if (scale == 1)
-                    {
-                        out_alpha_tile_gpu = in_alpha_tile_gpu;
-                    }
-                    if (scale == 2)
-                    {
-                        bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
-                    if (scale == 3)
+                    charge_stage("inference", &stats->inference, &t);
+                }
+
+                // postproc
+                postproc_gpu = out_gpu;
+                if (resample)
+                {
+                    if (byte_band)
                     {
-                        bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                        postproc_gpu.create(out_tile_gpu[0].w, out_tile_gpu[0].h, (size_t)channels, 1, blob_vkallocator);
                     }
-                    if (scale == 4)
+                    else
                     {
-                        bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                        postproc_gpu.create(out_tile_gpu[0].w, out_tile_gpu[0].h, channels, (size_t)4u, 1, blob_vkallocator);
                     }
                 }
-
-                // postproc
                 {
                     std::vector<ncnn::VkMat> bindings(10);
                     bindings[0] = out_tile_gpu[0];
@@ -406,29 +940,36 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
                     bindings[6] = out_tile_gpu[6];
                     bindings[7] = out_tile_gpu[7];
                     bindings[8] = out_alpha_tile_gpu;
-                    bindings[9] = out_gpu;
+                    bindings[9] = postproc_gpu;
 
-                    std::vector<ncnn::vk_constant_type> constants(13);
+                    std::vector<ncnn::vk_constant_type> constants(15);
                     constants[0].i = out_tile_gpu[0].w;
                     constants[1].i = out_tile_gpu[0].h;
                     constants[2].i = out_tile_gpu[0].cstep;
-                    constants[3].i = out_gpu.w;
-                    constants[4].i = out_gpu.h;
-                    constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    constants[8].i = prepadding * scale;
-                    constants[9].i = prepadding * scale;
+                    constants[3].i = postproc_gpu.w;
+                    constants[4].i = postproc_gpu.h;
+                    constants[5].i = postproc_gpu.cstep;
+                    constants[6].i = resample ? 0 : xi * TILE_SIZE_X * scale;
+                    constants[7].i = resample ? postproc_gpu.w : std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[8].i = resample ? 0 : prepadding * scale;
+                    constants[9].i = resample ? 0 : prepadding * scale;
                     constants[10].i = channels;
                     constants[11].i = out_alpha_tile_gpu.w;
                     constants[12].i = out_alpha_tile_gpu.h;
+                    constants[13].i = scale;
+                    constants[14].i = alpha_net ? 1 : 0;
 
                     ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    dispatcher.h = out_gpu.h;
+                    dispatcher.w = constants[7].i;
+                    dispatcher.h = postproc_gpu.h;
                     dispatcher.c = channels;
 
-                    cmd.record_pipeline(realesrgan_postproc, bindings, constants, dispatcher);
+                    cmd.record_pipeline(realesrgan_postproc[pi], bindings, constants, dispatcher);
+                }
+
+                if (stats)
+                {
+                    finish_stage(cmd, "postproc", &stats->postproc, &t);
                 }
             }
             else
@@ -447,35 +988,95 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
 
                     if (channels == 4)
                     {
-                        in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
+                        in_alpha_tile_gpu.create(tile_x1 - tile_x0, tile_y1 - tile_y0, alpha_net ? 3 : 1, in_out_tile_elemsize, 1, blob_vkallocator);
                     }
 
-                    std::vector<ncnn::VkMat> bindings(3);
-                    bindings[0] = in_gpu;
-                    bindings[1] = in_tile_gpu;
-                    bindings[2] = in_alpha_tile_gpu;
-
-                    std::vector<ncnn::vk_constant_type> constants(13);
-                    constants[0].i = in_gpu.w;
-                    constants[1].i = in_gpu.h;
-                    constants[2].i = in_gpu.cstep;
-                    constants[3].i = in_tile_gpu.w;
-                    constants[4].i = in_tile_gpu.h;
-                    constants[5].i = in_tile_gpu.cstep;
-                    constants[6].i = prepadding;
-                    constants[7].i = prepadding;
-                    constants[8].i = xi * TILE_SIZE_X;
-                    constants[9].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[10].i = channels;
-                    constants[11].i = in_alpha_tile_gpu.w;
-                    constants[12].i = in_alpha_tile_gpu.h;
-
-                    ncnn::VkMat dispatcher;
-                    dispatcher.w = in_tile_gpu.w;
-                    dispatcher.h = in_tile_gpu.h;
-                    dispatcher.c = channels;
+                    if (yuv420)
+                    {
+                        std::vector<ncnn::VkMat> bindings(4);
+                        bindings[0] = in_gpu;
+                        bindings[1] = in_u_gpu;
+                        bindings[2] = in_v_gpu;
+                        bindings[3] = in_tile_gpu;
+
+                        std::vector<ncnn::vk_constant_type> constants(12);
+                        constants[0].i = in_gpu.w;
+                        constants[1].i = in_gpu.h;
+                        constants[2].i = in_tile_gpu.w;
+                        constants[3].i = in_tile_gpu.h;
+                        constants[4].i = in_tile_gpu.cstep;
+                        constants[5].i = prepadding;
+                        constants[6].i = prepadding;
+                        constants[7].i = xi * TILE_SIZE_X;
+                        constants[8].i = std::min(yi * TILE_SIZE_Y, prepadding);
+                        constants[9].i = in_u_gpu.w;
+                        constants[10].i = in_tile_y0 % 2;
+                        constants[11].i = yuv_full_range ? 1 : 0;
+
+                        ncnn::VkMat dispatcher;
+                        dispatcher.w = in_tile_gpu.w;
+                        dispatcher.h = in_tile_gpu.h;
+                        dispatcher.c = 1;
+
+                        cmd.record_pipeline(realesrgan_preproc_yuv420, bindings, constants, dispatcher);
+                    }
+                    else
+                    {
+                        std::vector<ncnn::VkMat> bindings(3);
+                        bindings[0] = in_gpu;
+                        bindings[1] = in_tile_gpu;
+                        bindings[2] = in_alpha_tile_gpu;
+
+                        std::vector<ncnn::vk_constant_type> constants(14);
+                        constants[0].i = in_gpu.w;
+                        constants[1].i = in_gpu.h;
+                        constants[2].i = in_gpu.cstep;
+                        constants[3].i = in_tile_gpu.w;
+                        constants[4].i = in_tile_gpu.h;
+                        constants[5].i = in_tile_gpu.cstep;
+                        constants[6].i = prepadding;
+                        constants[7].i = prepadding;
+                        constants[8].i = xi * TILE_SIZE_X;
+                        constants[9].i = std::min(yi * TILE_SIZE_Y, prepadding);
+                        constants[10].i = channels;
+                        constants[11].i = in_alpha_tile_gpu.w;
+                        constants[12].i = in_alpha_tile_gpu.h;
+                        constants[13].i = alpha_net ? 1 : 0;
+
+                        if (stats)
+                        {
+                            stats->tiles++;
+                        }
+
+                        if (byte_band && vec4_shaders && realesrgan_preproc_vec4[pi] && in_tile_gpu.w % 4 == 0)
+                        {
+                            ncnn::VkMat dispatcher;
+                            dispatcher.w = in_tile_gpu.w / 4;
+                            dispatcher.h = in_tile_gpu.h;
+                            dispatcher.c = 1;
+
+                            cmd.record_pipeline(realesrgan_preproc_vec4[pi], bindings, constants, dispatcher);
+
+                            if (stats)
+                            {
+                                stats->vec4_preproc_tiles++;
+                            }
+                        }
+                        else
+                        {
+                            ncnn::VkMat dispatcher;
+                            dispatcher.w = in_tile_gpu.w;
+                            dispatcher.h = in_tile_gpu.h;
+                            dispatcher.c = channels;
+
+                            cmd.record_pipeline(realesrgan_preproc[pi], bindings, constants, dispatcher);
+                        }
+                    }
+                }
 
-                    cmd.record_pipeline(realesrgan_preproc, bindings, constants, dispatcher);
+                if (stats)
+                {
+                    finish_stage(cmd, "preproc", &stats->preproc, &t);
                 }
 
                 // realesrgan
@@ -492,55 +1093,161 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
                     ex.extract("output", out_tile_gpu, cmd);
                 }
 
-                ncnn::VkMat out_alpha_tile_gpu;
-                if (channels == 4)
+                // the alpha tile shares the command buffer of the rgb tile, no extra submission
+                ncnn::VkMat out_alpha_tile_gpu = in_alpha_tile_gpu;
+                if (alpha_net && channels == 4)
                 {
-                    if (scale == 1)
-                    {
-                        out_alpha_tile_gpu = in_alpha_tile_gpu;
-                    }
-                    if (scale == 2)
-                    {
-                        bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
-                    if (scale == 3)
+                    ncnn::Extractor ex = net.create_extractor();
+
+                    ex.set_blob_vkallocator(blob_vkallocator);
+                    ex.set_workspace_vkallocator(blob_vkallocator);
+                    ex.set_staging_vkallocator(staging_vkallocator);
+
+                    ex.input("data", in_alpha_tile_gpu);
+
+                    ex.extract("output", out_alpha_tile_gpu, cmd);
+                }
+
+                if (stats)
+                {
+                    finish_stage(cmd, "inference", &stats->inference, &t);
+                }
+
+                // postproc
+                postproc_gpu = out_gpu;
+                if (resample)
+                {
+                    if (byte_band)
                     {
-                        bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                        postproc_gpu.create(out_tile_gpu.w, out_tile_gpu.h, (size_t)channels, 1, blob_vkallocator);
                     }
-                    if (scale == 4)
+                    else
                     {
-                        bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
+                        postproc_gpu.create(out_tile_gpu.w, out_tile_gpu.h, channels, (size_t)4u, 1, blob_vkallocator);
                     }
                 }
-
-                // postproc
+                if (yuv420)
                 {
-                    std::vector<ncnn::VkMat> bindings(3);
+                    std::vector<ncnn::VkMat> bindings(4);
                     bindings[0] = out_tile_gpu;
-                    bindings[1] = out_alpha_tile_gpu;
-                    bindings[2] = out_gpu;
+                    bindings[1] = out_gpu;
+                    bindings[2] = out_u_gpu;
+                    bindings[3] = out_v_gpu;
 
-                    std::vector<ncnn::vk_constant_type> constants(13);
+                    std::vector<ncnn::vk_constant_type> constants(10);
                     constants[0].i = out_tile_gpu.w;
                     constants[1].i = out_tile_gpu.h;
                     constants[2].i = out_tile_gpu.cstep;
                     constants[3].i = out_gpu.w;
                     constants[4].i = out_gpu.h;
-                    constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[5].i = xi * TILE_SIZE_X * scale;
+                    constants[6].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[7].i = prepadding * scale;
                     constants[8].i = prepadding * scale;
-                    constants[9].i = prepadding * scale;
+                    constants[9].i = yuv_full_range ? 1 : 0;
+
+                    // one invocation per 2x2 block
+                    ncnn::VkMat dispatcher;
+                    dispatcher.w = constants[6].i / 2;
+                    dispatcher.h = out_gpu.h / 2;
+                    dispatcher.c = 1;
+
+                    cmd.record_pipeline(realesrgan_postproc_yuv420, bindings, constants, dispatcher);
+                }
+                else
+                {
+                    std::vector<ncnn::VkMat> bindings(3);
+                    bindings[0] = out_tile_gpu;
+                    bindings[1] = out_alpha_tile_gpu;
+                    bindings[2] = postproc_gpu;
+
+                    std::vector<ncnn::vk_constant_type> constants(15);
+                    constants[0].i = out_tile_gpu.w;
+                    constants[1].i = out_tile_gpu.h;
+                    constants[2].i = out_tile_gpu.cstep;
+                    constants[3].i = postproc_gpu.w;
+                    constants[4].i = postproc_gpu.h;
+                    constants[5].i = postproc_gpu.cstep;
+                    constants[6].i = resample ? 0 : xi * TILE_SIZE_X * scale;
+                    constants[7].i = resample ? postproc_gpu.w : std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                    constants[8].i = resample ? 0 : prepadding * scale;
+                    constants[9].i = resample ? 0 : prepadding * scale;
                     constants[10].i = channels;
                     constants[11].i = out_alpha_tile_gpu.w;
                     constants[12].i = out_alpha_tile_gpu.h;
+                    constants[13].i = scale;
+                    constants[14].i = alpha_net ? 1 : 0;
 
-                    ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    dispatcher.h = out_gpu.h;
-                    dispatcher.c = channels;
+                    // whole words on both sides, 3 channel rows only stay word aligned every 4 pixels
+                    const bool aligned = out_tile_gpu.w % 4 == 0 && constants[8].i % 4 == 0 && constants[7].i % 4 == 0
+                        && (channels == 4 || (postproc_gpu.w % 4 == 0 && constants[6].i % 4 == 0));
+
+                    if (byte_band && vec4_shaders && realesrgan_postproc_vec4[pi] && aligned)
+                    {
+                        ncnn::VkMat dispatcher;
+                        dispatcher.w = constants[7].i / 4;
+                        dispatcher.h = postproc_gpu.h;
+                        dispatcher.c = 1;
+
+                        cmd.record_pipeline(realesrgan_postproc_vec4[pi], bindings, constants, dispatcher);
 
-                    cmd.record_pipeline(realesrgan_postproc, bindings, constants, dispatcher);
+                        if (stats)
+                        {
+                            stats->vec4_postproc_tiles++;
+                        }
+                    }
+                    else
+                    {
+                        ncnn::VkMat dispatcher;
+                        dispatcher.w = constants[7].i;
+                        dispatcher.h = postproc_gpu.h;
+                        dispatcher.c = channels;
+
+                        cmd.record_pipeline(realesrgan_postproc[pi], bindings, constants, dispatcher);
+                    }
+                }
+
+                if (stats)
+                {
+                    finish_stage(cmd, "postproc", &stats->postproc, &t);
+                }
+            }
+
+            // resample the tile into the target band
+            if (resample)
+            {
+                std::vector<ncnn::VkMat> bindings(2);
+                bindings[0] = postproc_gpu;
+                bindings[1] = out_gpu;
+
+                std::vector<ncnn::vk_constant_type> constants(16);
+                constants[0].i = postproc_gpu.w;
+                constants[1].i = postproc_gpu.h;
+                constants[2].i = postproc_gpu.cstep;
+                constants[3].i = out_gpu.w;
+                constants[4].i = out_gpu.h;
+                constants[5].i = out_gpu.cstep;
+                constants[6].i = channels;
+                constants[7].i = (xi * TILE_SIZE_X - prepadding) * scale;
+                constants[8].i = (yi * TILE_SIZE_Y - prepadding) * scale;
+                constants[9].i = w * scale;
+                constants[10].i = h * scale;
+                constants[11].i = resample_x0;
+                constants[12].i = resample_y0;
+                constants[13].i = resample_x1 - resample_x0;
+                constants[14].f = (float)(w * scale) / outw;
+                constants[15].f = (float)(h * scale) / outh;
+
+                ncnn::VkMat dispatcher;
+                dispatcher.w = resample_x1 - resample_x0;
+                dispatcher.h = out_gpu.h;
+                dispatcher.c = channels;
+
+                cmd.record_pipeline(realesrgan_resample, bindings, constants, dispatcher);
+
+                if (stats)
+                {
+                    finish_stage(cmd, "resample", &stats->resample, &t);
                 }
             }
 
@@ -550,41 +1257,104 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
                 cmd.reset();
             }
 
-            fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
+            Progress::tiles(yi * xtiles + xi + 1, ytiles * xtiles);
         }
 
+        unsigned char *outptr = resample ? (unsigned char *)outimage.data + (size_t)resample_y0 * outw * channels : (unsigned char *)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels;
+
         // download
+        if (yuv420)
+        {
+            // band rows are contiguous in each plane
+            const int y0 = yi * scale * TILE_SIZE_Y;
+            unsigned char *y_plane = (unsigned char *)outimage.data;
+            unsigned char *u_plane = y_plane + (size_t)outw * outh;
+            unsigned char *v_plane = u_plane + (size_t)(outw / 2) * (outh / 2);
+
+            ncnn::Mat out(out_gpu.w, out_gpu.h, y_plane + (size_t)y0 * outw, (size_t)1u, 1);
+            ncnn::Mat out_u(out_u_gpu.w, out_u_gpu.h, u_plane + (size_t)(y0 / 2) * (outw / 2), (size_t)1u, 1);
+            ncnn::Mat out_v(out_v_gpu.w, out_v_gpu.h, v_plane + (size_t)(y0 / 2) * (outw / 2), (size_t)1u, 1);
+
+            cmd.record_clone(out_gpu, out, opt);
+            cmd.record_clone(out_u_gpu, out_u, opt);
+            cmd.record_clone(out_v_gpu, out_v, opt);
+
+            cmd.submit_and_wait();
+
+            if (stats)
+            {
+                charge_stage("download", &stats->download, &t);
+            }
+        }
+        else
         {
             ncnn::Mat out;
 
-            if (opt.use_fp16_storage && opt.use_int8_storage)
+            if (byte_band)
             {
-                out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char *)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, (size_t)channels, 1);
+                out = ncnn::Mat(out_gpu.w, out_gpu.h, outptr, (size_t)channels, 1);
             }
 
             cmd.record_clone(out_gpu, out, opt);
 
             cmd.submit_and_wait();
 
-            if (!(opt.use_fp16_storage && opt.use_int8_storage))
+            if (!byte_band)
             {
                 if (channels == 3)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char *)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
+                    out.to_pixels(outptr, ncnn::Mat::PIXEL_RGB2BGR);
 #else
-                    out.to_pixels((unsigned char *)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
+                    out.to_pixels(outptr, ncnn::Mat::PIXEL_RGB);
 #endif
                 }
                 if (channels == 4)
                 {
 #if _WIN32
-                    out.to_pixels((unsigned char *)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
+                    out.to_pixels(outptr, ncnn::Mat::PIXEL_RGBA2BGRA);
 #else
-                    out.to_pixels((unsigned char *)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
+                    out.to_pixels(outptr, ncnn::Mat::PIXEL_RGBA);
 #endif
                 }
             }
+
+            if (stats)
+            {
+                charge_stage("download", &stats->download, &t);
+            }
+        }
+
+        // transparent tiles were not run, their target pixels in the band are undefined
+        for (int xi = 0; resample && transparent_count > 0 && xi < xtiles; xi++)
+        {
+            if (transparent[xi])
+            {
+                const int x0 = resample_start(xi * TILE_SIZE_X * scale, w * scale, outw);
+                const int x1 = resample_start(std::min((xi + 1) * TILE_SIZE_X, w) * scale, w * scale, outw);
+
+                clear_output(outimage, x0, resample_y0, x1, resample_y1);
+            }
+        }
+
+        for (int xi = 0; xi < (int)known_tiles.size(); xi++)
+        {
+            if (!known_tiles[xi].empty())
+            {
+                copy_tile_output(outimage, xi, yi, TILE_SIZE_X, scale, known_tiles[xi], true);
+            }
+            else
+            {
+                copy_tile_output(outimage, xi, yi, TILE_SIZE_X, scale, known_tiles[xi], false);
+
+                if (tile_cache)
+                    tile_cache->put(tile_keys[xi], known_tiles[xi]);
+                if (tile_history)
+                    tile_history->computed.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (tile_history)
+                tile_history->put(xi, yi, tile_keys[xi], known_tiles[xi]);
         }
     }
 
@@ -593,3 +1363,466 @@ int RealESRGAN::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const
 
     return 0;
 }
+
+int RealESRGAN::process_roi(const ncnn::Mat &inimage, int roi_x, int roi_y, int roi_w, int roi_h, ncnn::Mat &outimage, ProcessStats *stats) const
+{
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    if (yuv420 || roi_w <= 0 || roi_h <= 0 || roi_x < 0 || roi_y < 0 || roi_x + roi_w > w || roi_y + roi_h > h
+        || outimage.w != roi_w * scale || outimage.h != roi_h * scale)
+    {
+        fprintf(stderr, "🚨 Error: Unsupported region %d,%d %dx%d of %dx%d\n", roi_x, roi_y, roi_w, roi_h, w, h);
+        return -1;
+    }
+
+    if (roi_w == w && roi_h == h)
+    {
+        return process(inimage, outimage, stats);
+    }
+
+    // the roi with the real pixels its tiles are padded with, reflection only happens at the image border
+    const int x0 = std::max(roi_x - prepadding, 0);
+    const int y0 = std::max(roi_y - prepadding, 0);
+    const int x1 = std::min(roi_x + roi_w + prepadding, w);
+    const int y1 = std::min(roi_y + roi_h + prepadding, h);
+
+    ncnn::Mat in(x1 - x0, y1 - y0, (size_t)channels, channels);
+    for (int y = y0; y < y1; y++)
+    {
+        memcpy((unsigned char *)in.data + (size_t)(y - y0) * in.w * channels, (const unsigned char *)inimage.data + ((size_t)y * w + x0) * channels, (size_t)in.w * channels);
+    }
+
+    ncnn::Mat out(in.w * scale, in.h * scale, (size_t)channels, channels);
+    int ret = process(in, out, stats);
+    if (ret != 0)
+        return ret;
+
+    // drop the x{scale} margin
+    const int offset_x = (roi_x - x0) * scale;
+    const int offset_y = (roi_y - y0) * scale;
+    for (int y = 0; y < outimage.h; y++)
+    {
+        memcpy((unsigned char *)outimage.data + (size_t)y * outimage.w * channels, (const unsigned char *)out.data + ((size_t)(y + offset_y) * out.w + offset_x) * channels, (size_t)outimage.w * channels);
+    }
+
+    return 0;
+}
+
+int RealESRGAN::process_cpu(const ncnn::Mat &inimage, ncnn::Mat &outimage, ProcessStats *stats) const
+{
+    const unsigned char *pixeldata = (const unsigned char *)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    if (outimage.w != w * scale || outimage.h != h * scale)
+    {
+        fprintf(stderr, "🚨 Error: Unsupported output size %dx%d\n", outimage.w, outimage.h);
+        return -1;
+    }
+
+    const int TILE_SIZE_X = tilesize;
+    const int TILE_SIZE_Y = tilesize;
+
+    // each tile 100x100
+    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
+    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+
+    const int tta_count = tta_mode ? 8 : 1;
+
+    ProcessStats trace_stats;
+    if (!stats && Tracer::enabled())
+    {
+        stats = &trace_stats;
+    }
+
+    if (tile_history)
+    {
+        tile_history->begin_frame(xtiles, ytiles);
+    }
+
+    AlphaBounds alpha_bounds;
+    if (skip_transparent && channels == 4)
+    {
+        alpha_bounds.build(pixeldata, w, h, channels, TILE_SIZE_X);
+    }
+
+    for (int yi = 0; yi < ytiles; yi++)
+    {
+        for (int xi = 0; xi < xtiles; xi++)
+        {
+            if (transparent_tile(alpha_bounds, xi, yi, TILE_SIZE_X, prepadding))
+            {
+                const int x0 = xi * TILE_SIZE_X * scale;
+                const int y0 = yi * TILE_SIZE_Y * scale;
+
+                clear_output(outimage, x0, y0, std::min((xi + 1) * TILE_SIZE_X, w) * scale, std::min((yi + 1) * TILE_SIZE_Y, h) * scale);
+
+                Progress::tiles(yi * xtiles + xi + 1, ytiles * xtiles);
+                continue;
+            }
+
+            std::vector<unsigned char> uniform_pixels;
+            if (skip_uniform && uniform_tile(inimage, xi, yi, uniform_pixels))
+            {
+                copy_tile_output(outimage, xi, yi, TILE_SIZE_X, scale, uniform_pixels, true);
+
+                Progress::tiles(yi * xtiles + xi + 1, ytiles * xtiles);
+                continue;
+            }
+
+            TileCache::Key key;
+            if (tile_history)
+            {
+                std::vector<unsigned char> pixels;
+                key = tile_key(inimage, xi, yi, TILE_SIZE_X, prepadding, scale, tta_mode);
+                if (tile_history->get(xi, yi, key, pixels))
+                {
+                    copy_tile_output(outimage, xi, yi, TILE_SIZE_X, scale, pixels, true);
+
+                    Progress::tiles(yi * xtiles + xi + 1, ytiles * xtiles);
+                    continue;
+                }
+            }
+
+            double t = stats ? ncnn::get_current_time() : 0;
+
+            // preproc
+            ncnn::Mat in_tile[8];
+            ncnn::Mat in_alpha_tile;
+            {
+                // crop tile
+                int tile_x0 = xi * TILE_SIZE_X - prepadding;
+                int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding;
+                int tile_y0 = yi * TILE_SIZE_Y - prepadding;
+                int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding;
+
+                const int tile_w = tile_x1 - tile_x0;
+                const int tile_h = tile_y1 - tile_y0;
+
+                for (int ti = 0; ti < tta_count; ti++)
+                {
+                    if (ti < 4)
+                        in_tile[ti].create(tile_w, tile_h, 3);
+                    else
+                        in_tile[ti].create(tile_h, tile_w, 3);
+                }
+
+                if (channels == 4)
+                {
+                    in_alpha_tile.create(tile_w, tile_h, alpha_net ? 3 : 1);
+                }
+
+                for (int y = 0; y < tile_h; y++)
+                {
+                    const int sy = reflect_border(tile_y0 + y, h);
+
+                    for (int x = 0; x < tile_w; x++)
+                    {
+                        const int sx = reflect_border(tile_x0 + x, w);
+
+                        const unsigned char *ptr = pixeldata + ((size_t)sy * w + sx) * channels;
+
+                        for (int q = 0; q < 3; q++)
+                        {
+#if _WIN32
+                            const float v = ptr[2 - q] * (1 / 255.f);
+#else
+                            const float v = ptr[q] * (1 / 255.f);
+#endif
+                            for (int ti = 0; ti < tta_count; ti++)
+                            {
+                                float *outptr = in_tile[ti].channel(q);
+                                outptr[tta_offset(ti, x, y, tile_w, tile_h)] = v;
+                            }
+                        }
+
+                        if (channels == 4 && alpha_net)
+                        {
+                            const float v = ptr[3] * (1 / 255.f);
+                            for (int q = 0; q < 3; q++)
+                            {
+                                in_alpha_tile.channel(q).row(y)[x] = v;
+                            }
+                        }
+                        else if (channels == 4)
+                        {
+                            in_alpha_tile.row(y)[x] = ptr[3];
+                        }
+                    }
+                }
+            }
+
+            if (stats)
+            {
+                charge_stage("preproc", &stats->preproc, &t);
+            }
+
+            // realesrgan
+            ncnn::Mat out_tile[8];
+            for (int ti = 0; ti < tta_count; ti++)
+            {
+                ncnn::Extractor ex = net.create_extractor();
+
+                ex.input("data", in_tile[ti]);
+
+                ex.extract("output", out_tile[ti]);
+            }
+
+            ncnn::Mat out_alpha_tile;
+            if (channels == 4 && alpha_net)
+            {
+                ncnn::Extractor ex = net.create_extractor();
+
+                ex.input("data", in_alpha_tile);
+
+                ex.extract("output", out_alpha_tile);
+            }
+
+            if (stats)
+            {
+                charge_stage("inference", &stats->inference, &t);
+            }
+
+            // postproc
+            {
+                const int crop = prepadding * scale;
+                const int out_x0 = xi * TILE_SIZE_X * scale;
+                const int out_y0 = yi * TILE_SIZE_Y * scale;
+                const int out_tile_w = std::min((xi + 1) * TILE_SIZE_X, w) * scale - out_x0;
+                const int out_tile_h = std::min((yi + 1) * TILE_SIZE_Y, h) * scale - out_y0;
+
+                const int outw = out_tile[0].w;
+                const int outh = out_tile[0].h;
+
+                for (int y = 0; y < out_tile_h; y++)
+                {
+                    unsigned char *outptr = (unsigned char *)outimage.data + ((size_t)(out_y0 + y) * outimage.w + out_x0) * channels;
+
+                    for (int x = 0; x < out_tile_w; x++)
+                    {
+                        for (int q = 0; q < 3; q++)
+                        {
+                            float v = 0.f;
+                            for (int ti = 0; ti < tta_count; ti++)
+                            {
+                                const float *ptr = out_tile[ti].channel(q);
+                                v += ptr[tta_offset(ti, x + crop, y + crop, outw, outh)];
+                            }
+
+                            v = v / tta_count * 255.f + 0.5f;
+
+#if _WIN32
+                            outptr[2 - q] = (unsigned char)std::min(std::max((int)floorf(v), 0), 255);
+#else
+                            outptr[q] = (unsigned char)std::min(std::max((int)floorf(v), 0), 255);
+#endif
+                        }
+
+                        if (channels == 4)
+                        {
+                            float v;
+                            if (alpha_net)
+                            {
+                                v = 0.f;
+                                for (int q = 0; q < 3; q++)
+                                {
+                                    v += out_alpha_tile.channel(q).row(y + crop)[x + crop];
+                                }
+
+                                v = v / 3 * 255.f + 0.5f;
+                            }
+                            else
+                            {
+                                v = bicubic_alpha(in_alpha_tile, x + crop, y + crop, scale) + 0.5f;
+                            }
+
+                            outptr[3] = (unsigned char)std::min(std::max((int)floorf(v), 0), 255);
+                        }
+
+                        outptr += channels;
+                    }
+                }
+            }
+
+            if (stats)
+            {
+                charge_stage("postproc", &stats->postproc, &t);
+            }
+
+            if (tile_history)
+            {
+                std::vector<unsigned char> pixels;
+                copy_tile_output(outimage, xi, yi, TILE_SIZE_X, scale, pixels, false);
+                tile_history->put(xi, yi, key, pixels);
+                tile_history->computed.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            Progress::tiles(yi * xtiles + xi + 1, ytiles * xtiles);
+        }
+    }
+
+    return 0;
+}
+
+void RealESRGAN::uniform_response(const unsigned char *color, std::vector<unsigned char> &block) const
+{
+    const uint32_t key = color[0] | (color[1] << 8) | (color[2] << 16);
+
+    uniform_lock.lock();
+    std::map<uint32_t, std::vector<unsigned char> >::const_iterator it = uniform_blocks.find(key);
+    const bool found = it != uniform_blocks.end();
+    if (found)
+        block = it->second;
+    uniform_lock.unlock();
+
+    if (found)
+        return;
+
+    // the center of a uniform tile is far enough from the zero padding inside the network
+    const int size = prepadding * 2 + 16;
+
+    ncnn::Mat in(size, size, 3);
+    for (int q = 0; q < 3; q++)
+    {
+#if _WIN32
+        in.channel(q).fill(color[2 - q] * (1 / 255.f));
+#else
+        in.channel(q).fill(color[q] * (1 / 255.f));
+#endif
+    }
+
+    ncnn::Extractor ex = net.create_extractor();
+
+    ex.input("data", in);
+
+    ncnn::Mat response;
+    ex.extract("output", response);
+
+    // pixelshuffle models answer a flat input with a pattern that repeats every scale pixels
+    // so keep the block of one input pixel, at the phase it has in every tile
+    const int bx = size / 2 * scale;
+    const int by = size / 2 * scale;
+    const bool ok = !response.empty() && response.w == size * scale && response.h == size * scale;
+
+    // every tta variant of a flat square is the same input, so the one response read back at the flipped
+    // and transposed positions gives what each variant contributes to the average in process()
+    const int tta_count = tta_mode ? 8 : 1;
+
+    block.resize((size_t)scale * scale * 4);
+    for (int j = 0; j < scale; j++)
+    {
+        for (int i = 0; i < scale; i++)
+        {
+            for (int q = 0; q < 3; q++)
+            {
+                float v = 0.f;
+                for (int ti = 0; ok && ti < tta_count; ti++)
+                {
+                    const float *ptr = response.channel(q);
+                    v += ptr[tta_offset(ti, bx + i, by + j, response.w, response.h)];
+                }
+
+                v = v / tta_count * 255.f + 0.5f;
+#if _WIN32
+                const int k = 2 - q;
+#else
+                const int k = q;
+#endif
+                block[((size_t)j * scale + i) * 4 + k] = (unsigned char)std::min(std::max((int)floorf(v), 0), 255);
+            }
+
+            // the alpha net answer to a gray (a,a,a) tile is the channel mean of one pass, alpha tiles get no tta
+            float a = 0.f;
+            for (int q = 0; ok && q < 3; q++)
+            {
+                a += response.channel(q).row(by + j)[bx + i];
+            }
+
+            a = a / 3 * 255.f + 0.5f;
+            block[((size_t)j * scale + i) * 4 + 3] = (unsigned char)std::min(std::max((int)floorf(a), 0), 255);
+        }
+    }
+
+    uniform_lock.lock();
+    uniform_blocks[key] = block;
+    uniform_lock.unlock();
+}
+
+bool RealESRGAN::uniform_tile(const ncnn::Mat &inimage, int xi, int yi, std::vector<unsigned char> &pixels) const
+{
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    // the padded region as preproc reads it
+    const int x0 = std::max(xi * tilesize - prepadding, 0);
+    const int x1 = std::min((xi + 1) * tilesize + prepadding, w);
+    const int y0 = std::max(yi * tilesize - prepadding, 0);
+    const int y1 = std::min((yi + 1) * tilesize + prepadding, h);
+
+    const size_t stride = (size_t)w * channels;
+    const size_t rowbytes = (size_t)(x1 - x0) * channels;
+    const unsigned char *row0 = (const unsigned char *)inimage.data + y0 * stride + (size_t)x0 * channels;
+
+    // a row is uniform when it equals itself shifted by one pixel
+    bool uniform = memcmp(row0, row0 + channels, rowbytes - channels) == 0;
+    for (int y = y0 + 1; uniform && y < y1; y++)
+    {
+        uniform = memcmp(row0 + (y - y0) * stride, row0, rowbytes) == 0;
+    }
+
+    // fully transparent tiles are found from the alpha bounds beforehand
+    if (!uniform)
+        return false;
+
+    std::vector<unsigned char> block;
+    uniform_response(row0, block);
+
+    // alpha goes through the network as a gray tile with --alpha-net, bicubic of a flat alpha is the alpha itself
+    std::vector<unsigned char> alpha_block;
+    if (channels == 4 && alpha_net)
+    {
+        const unsigned char gray[3] = {row0[3], row0[3], row0[3]};
+        uniform_response(gray, alpha_block);
+    }
+
+    const int out_w = (std::min((xi + 1) * tilesize, w) - xi * tilesize) * scale;
+    const int out_h = (std::min((yi + 1) * tilesize, h) - yi * tilesize) * scale;
+
+    // tiles start at multiples of scale in the output, so the block repeats from their corner
+    pixels.resize((size_t)out_w * out_h * channels);
+    for (int y = 0; y < out_h; y++)
+    {
+        unsigned char *out = &pixels[(size_t)y * out_w * channels];
+        const unsigned char *block_row = &block[(size_t)(y % scale) * scale * 4];
+        for (int x = 0; x < out_w; x++)
+        {
+            memcpy(out + (size_t)x * channels, block_row + (x % scale) * 4, 3);
+            if (channels == 4)
+                out[(size_t)x * channels + 3] = alpha_net ? alpha_block[((size_t)(y % scale) * scale + x % scale) * 4 + 3] : row0[3];
+        }
+    }
+
+    return true;
+}
+
+bool RealESRGAN::support_yuv420() const
+{
+    return realesrgan_preproc_yuv420 != 0;
+}
+
+bool RealESRGAN::support_resample(int w, int h, int outw, int outh) const
+{
+    // the cpu path always produces the x{scale} output
+    if (!net.opt.use_vulkan_compute || outw <= 0 || outh <= 0)
+        return false;
+
+    // the taps of a target pixel reach at most half its span, plus one for bilinear, past its tile
+    const int span_w = (w * scale + outw - 1) / outw;
+    const int span_h = (h * scale + outh - 1) / outh;
+
+    return std::max(span_w, span_h) / 2 + 1 <= prepadding * scale;
+}
@@ -3,16 +3,59 @@
 #ifndef REALESRGAN_H
 #define REALESRGAN_H
 
+#include <map>
 #include <string>
+#include <vector>
 
 // ncnn
 #include "net.h"
 #include "gpu.h"
 #include "layer.h"
+#include "platform.h"
+
+// milliseconds spent in each stage of one process() call
+// every stage is waited for on its own when collecting, so the sum is a bit above an unprofiled run
+class ProcessStats
+{
+public:
+    ProcessStats();
+
+    double upload;
+    double preproc;
+    double inference;
+    double postproc;
+    double resample;
+    double download;
+
+    // tiles through the rgb pre/post shaders, and how many of them took the vec4 ones
+    int tiles;
+    int vec4_preproc_tiles;
+    int vec4_postproc_tiles;
+};
+
+// numeric precision of the network, fp16 storage is the default
+// ncnn turns the fp16 options off again on devices without support
+// int8 needs a model quantized by calibrate-int8.sh, ncnn has no int8 vulkan convolution so it is meant for cpu
+enum
+{
+    PRECISION_FP32 = 0,
+    PRECISION_FP16_STORAGE,
+    PRECISION_FP16_ARITHMETIC,
+    PRECISION_INT8,
+    PRECISION_COUNT
+};
+
+// fp32, fp16s, fp16a or int8, -1 for anything else
+int parse_precision(const char *name);
+const char *precision_name(int precision);
+
+class TileCache;
+class TileHistory;
 
 class RealESRGAN
 {
 public:
+    // gpuid -1 runs on cpu
     RealESRGAN(int gpuid, bool tta_mode = false);
     ~RealESRGAN();
 
@@ -22,7 +65,23 @@ public:
     int load(const std::string &parampath, const std::string &modelpath);
 #endif
 
-    int process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const;
+    // native scale measured by running the model on a small input, 0 on failure
+    int probe_scale() const;
+
+    // outimage may be any size, the x{scale} output is resampled to it, see support_resample()
+    int process(const ncnn::Mat &inimage, ncnn::Mat &outimage, ProcessStats *stats = 0) const;
+
+    int process_cpu(const ncnn::Mat &inimage, ncnn::Mat &outimage, ProcessStats *stats = 0) const;
+
+    // only the roi of inimage, outimage is roi_w * scale x roi_h * scale
+    // the work is about that of a roi sized image, its tiles are padded with the real pixels around it
+    int process_roi(const ncnn::Mat &inimage, int roi_x, int roi_y, int roi_w, int roi_h, ncnn::Mat &outimage, ProcessStats *stats = 0) const;
+
+    // whether the x{scale} output of a w x h image can be resampled to outw x outh on gpu
+    bool support_resample(int w, int h, int outw, int outh) const;
+
+    // whether process() takes planar yuv420 frames, see yuv420
+    bool support_yuv420() const;
 
 public:
     // realesrgan parameters
@@ -30,14 +89,61 @@ public:
     int tilesize;
     int prepadding;
 
+    // reuse upscaled tiles with identical padded input, shared between instances, gpu only and not when resampling
+    TileCache *tile_cache;
+
+    // reuse the previous frame's output for tiles whose padded input did not change, frames must come in order
+    TileHistory *tile_history;
+
+    // fill tiles that are uniform across their padded input without running the network
+    bool skip_uniform;
+
+    // zero fill rgba tiles whose padded input has no visible pixel, found from the alpha bounds of the image
+    bool skip_transparent;
+
+    // inimage and outimage are planar yuv420 with even sizes, elempack 1, converted in the pre/post shaders
+    // gpu only, no tta and no resampling, the tile caches and uniform skipping are off
+    bool yuv420;
+    bool yuv_full_range;
+
+    // upscale alpha with the network as a gray rgb tile instead of bicubic, sharper edges for sprites
+    // each alpha tile is recorded into the command buffer of its rgb tile
+    bool alpha_net;
+
+    // pre/post shaders that handle 4 pixels per invocation with packed loads and stores, non tta, any storage precision
+    // tiles whose widths or offsets are not multiples of 4 use the scalar shaders either way
+    // without int8 storage that means a float band for the whole image, so only fully aligned images without resampling use them
+    bool vec4_shaders;
+
+    // one of PRECISION_*, applied by load()
+    int precision;
+
+    // probe_scale() of the loaded model, set by load()
+    int native_scale;
+
+private:
+    // x{scale} output of a uniform tile, the scale x scale block that repeats over it, 4 bytes a pixel
+    // rgb in image channel order averaged over the tta variants like the tiles around it, then the channel mean alpha_net uses
+    void uniform_response(const unsigned char *color, std::vector<unsigned char> &block) const;
+
+    bool uniform_tile(const ncnn::Mat &inimage, int xi, int yi, std::vector<unsigned char> &pixels) const;
+
 private:
     ncnn::Net net;
-    ncnn::Pipeline *realesrgan_preproc;
-    ncnn::Pipeline *realesrgan_postproc;
-    ncnn::Layer *bicubic_2x;
-    ncnn::Layer *bicubic_3x;
-    ncnn::Layer *bicubic_4x;
+    // pre/post pipelines are indexed by channels - 3, each specialized on its channel count and pipeline_scale
+    ncnn::Pipeline *realesrgan_preproc[2];
+    ncnn::Pipeline *realesrgan_postproc[2];
+    ncnn::Pipeline *realesrgan_resample;
+    ncnn::Pipeline *realesrgan_preproc_yuv420;
+    ncnn::Pipeline *realesrgan_postproc_yuv420;
+    ncnn::Pipeline *realesrgan_preproc_vec4[2];
+    ncnn::Pipeline *realesrgan_postproc_vec4[2];
+    int pipeline_scale; // 0 when probing failed, postproc reads the scale push constant then
     bool tta_mode;
+
+    // model response per uniform input color, packed rgb key
+    mutable ncnn::Mutex uniform_lock;
+    mutable std::map<uint32_t, std::vector<unsigned char> > uniform_blocks;
 };
 
 #endif // REALESRGAN_H
@@ -0,0 +1,141 @@
+// benchmark for the post-upscale resize stage
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#define STB_IMAGE_RESIZE2_IMPLEMENTATION
+#include "stb_image_resize2.h"
+#include "image_resize.h"
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+static const char *resizemodes[] = {
+    "default",      // STBIR_FILTER_DEFAULT
+    "box",          // STBIR_FILTER_BOX
+    "triangle",     // STBIR_FILTER_TRIANGLE
+    "cubicbspline", // STBIR_FILTER_CUBICBSPLINE
+    "catmullrom",   // STBIR_FILTER_CATMULLROM
+    "mitchell",     // STBIR_FILTER_MITCHELL
+    "pointsample"   // STBIR_FILTER_POINT_SAMPLE
+};
+
+static double get_current_time()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// typical jobs, the source is the x4 output of the input size
+struct ResizeCase
+{
+    const char *name;
+    int w;
+    int h;
+    int outw;
+    int outh;
+};
+
+static void benchmark(const char *name, const unsigned char *pixeldata, int w, int h, unsigned char *outdata, int outw, int outh, int c, int filter, int num_threads, int loop_count)
+{
+    double time_min = 1e300;
+    double time_max = 0;
+    double time_avg = 0;
+
+    for (int i = 0; i < loop_count; i++)
+    {
+        double start = get_current_time();
+
+        if (num_threads == 0)
+        {
+            // the old single threaded path
+            stbir_resize_uint8_srgb(pixeldata, w, h, 0, outdata, outw, outh, 0, static_cast<stbir_pixel_layout>(c));
+        }
+        else
+        {
+            resize_image(pixeldata, w, h, outdata, outw, outh, c, filter, num_threads);
+        }
+
+        double end = get_current_time();
+
+        double time = end - start;
+
+        time_min = std::min(time_min, time);
+        time_max = std::max(time_max, time);
+        time_avg += time;
+    }
+
+    time_avg /= loop_count;
+
+    const double mpix = (double)w * h / 1000000;
+
+    fprintf(stderr, "%24s  c=%d  %-12s  threads=%-2d  min = %8.2f  max = %8.2f  avg = %8.2f ms  %7.1f MP/s\n", name, c, num_threads == 0 ? "legacy" : resizemodes[filter], num_threads, time_min, time_max, time_avg, mpix / time_avg * 1000);
+}
+
+int main(int argc, char **argv)
+{
+    int loop_count = 4;
+    int num_threads = 0;
+
+    if (argc >= 2)
+    {
+        loop_count = atoi(argv[1]);
+    }
+    if (argc >= 3)
+    {
+        num_threads = atoi(argv[2]);
+    }
+
+    if (num_threads <= 0)
+    {
+#if _OPENMP
+        num_threads = omp_get_max_threads();
+#else
+        num_threads = 1;
+#endif
+    }
+
+    fprintf(stderr, "loop_count = %d\n", loop_count);
+    fprintf(stderr, "num_threads = %d\n", num_threads);
+
+    const ResizeCase cases[] = {
+        {"1920x1080 x4 -> 1920w", 1920 * 4, 1080 * 4, 1920, 1080},
+        {"1920x1080 x4 -> x2", 1920 * 4, 1080 * 4, 1920 * 2, 1080 * 2},
+        {"1920x1080 x4 -> x3", 1920 * 4, 1080 * 4, 1920 * 3, 1080 * 3},
+        {"1280x720 x4 -> 3840x2160", 1280 * 4, 720 * 4, 3840, 2160},
+        {"512x512 x4 -> 1000x1000", 512 * 4, 512 * 4, 1000, 1000},
+    };
+
+    for (int c = 3; c <= 4; c++)
+    {
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+            const ResizeCase &rc = cases[i];
+
+            std::vector<unsigned char> pixeldata((size_t)rc.w * rc.h * c);
+            for (size_t j = 0; j < pixeldata.size(); j++)
+            {
+                pixeldata[j] = (unsigned char)((j * 2654435761u) >> 24);
+            }
+
+            std::vector<unsigned char> outdata((size_t)rc.outw * rc.outh * c);
+
+            benchmark(rc.name, pixeldata.data(), rc.w, rc.h, outdata.data(), rc.outw, rc.outh, c, 0, 0, loop_count);
+
+            for (int filter = 0; filter < (int)(sizeof(resizemodes) / sizeof(resizemodes[0])); filter++)
+            {
+                benchmark(rc.name, pixeldata.data(), rc.w, rc.h, outdata.data(), rc.outw, rc.outh, c, filter, 1, loop_count);
+
+                if (num_threads > 1)
+                {
+                    benchmark(rc.name, pixeldata.data(), rc.w, rc.h, outdata.data(), rc.outw, rc.outh, c, filter, num_threads, loop_count);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
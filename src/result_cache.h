@@ -0,0 +1,318 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+// content addressed result cache for --cache and --skip-existing
+// the index lives next to the outputs as .upscayl-cache, one tab separated line per output file
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <map>
+#include <string>
+
+#if __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#elif __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+// ncnn
+#include "platform.h"
+
+#include "hash.h"
+
+// reflink on btrfs, xfs and apfs, a plain copy everywhere else
+static bool clone_file(const std::filesystem::path &source, const std::filesystem::path &dest)
+{
+#if __linux__ && defined(FICLONE)
+    int in = ::open(source.c_str(), O_RDONLY);
+    if (in >= 0)
+    {
+        int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool cloned = false;
+        if (out >= 0)
+        {
+            cloned = ioctl(out, FICLONE, in) == 0;
+            ::close(out);
+        }
+        ::close(in);
+
+        if (cloned)
+            return true;
+    }
+#elif __APPLE__
+    std::error_code remove_ec;
+    std::filesystem::remove(dest, remove_ec);
+    if (clonefile(source.c_str(), dest.c_str(), 0) == 0)
+        return true;
+#endif
+
+    std::error_code ec;
+    return std::filesystem::copy_file(source, dest, std::filesystem::copy_options::overwrite_existing, ec);
+}
+
+class ResultCacheEntry
+{
+public:
+    std::string key; // empty when the input was never hashed, only --skip-existing can match it then
+    uint64_t options;
+    long long input_size;
+    long long input_mtime;
+    long long output_size;
+    long long output_mtime;
+};
+
+class ResultCache
+{
+public:
+    ResultCache()
+    {
+        options = 0;
+        fp = 0;
+        dirty = false;
+    }
+
+    ~ResultCache()
+    {
+        close();
+    }
+
+    // options is a hash of everything besides the input bytes that changes the output
+    int open(const std::filesystem::path &_dir, uint64_t _options)
+    {
+        dir = _dir;
+        options = _options;
+
+        const std::filesystem::path indexpath = dir / ".upscayl-cache";
+
+#if _WIN32
+        FILE *in = _wfopen(indexpath.c_str(), L"rb");
+#else
+        FILE *in = fopen(indexpath.c_str(), "rb");
+#endif
+        int lines = 0;
+        if (in)
+        {
+            char line[4096];
+            while (fgets(line, sizeof(line), in))
+            {
+                lines++;
+
+                char key[64];
+                unsigned long long opts;
+                ResultCacheEntry e;
+                int pos = 0;
+                if (sscanf(line, "%63[0-9a-f-]\t%llx\t%lld\t%lld\t%lld\t%lld\t%n", key, &opts, &e.input_size, &e.input_mtime, &e.output_size, &e.output_mtime, &pos) != 6 || pos == 0)
+                    continue;
+
+                std::string name = line + pos;
+                while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+                    name.pop_back();
+
+                e.key = strcmp(key, "-") == 0 ? std::string() : std::string(key);
+                e.options = opts;
+
+                // later lines win, the file is append only while running
+                set_entry(name, e);
+            }
+            fclose(in);
+        }
+
+        // rewrite on close when stale lines pile up
+        dirty = lines > (int)entries.size();
+
+#if _WIN32
+        fp = _wfopen(indexpath.c_str(), L"ab");
+#else
+        fp = fopen(indexpath.c_str(), "ab");
+#endif
+        return fp ? 0 : -1;
+    }
+
+    void close()
+    {
+        if (!fp)
+            return;
+
+        fclose(fp);
+        fp = 0;
+
+        if (!dirty)
+            return;
+
+        // compact, written aside and renamed over
+        const std::filesystem::path indexpath = dir / ".upscayl-cache";
+        std::filesystem::path tmppath = indexpath;
+        tmppath += ".tmp";
+
+#if _WIN32
+        FILE *out = _wfopen(tmppath.c_str(), L"wb");
+#else
+        FILE *out = fopen(tmppath.c_str(), "wb");
+#endif
+        if (!out)
+            return;
+
+        for (std::map<std::string, ResultCacheEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            write_line(out, it->first, it->second);
+        }
+        fclose(out);
+
+        std::error_code ec;
+        std::filesystem::rename(tmppath, indexpath, ec);
+    }
+
+    // includes the output extension, the same input becomes a different file per format
+    std::string key(const unsigned char *data, size_t len, const std::filesystem::path &output) const
+    {
+        const std::string ext = output.extension().u8string();
+
+        char buf[40];
+        sprintf(buf, "%016llx%016llx", (unsigned long long)hash64(data, len, 0), (unsigned long long)hash64(ext.data(), ext.size(), options));
+        return buf;
+    }
+
+    // --skip-existing, only stats both files
+    bool is_fresh(const std::filesystem::path &input, const std::filesystem::path &output)
+    {
+        long long input_size, input_mtime, output_size, output_mtime;
+        if (!stat(input, &input_size, &input_mtime) || !stat(output, &output_size, &output_mtime) || output_size == 0)
+            return false;
+
+        ResultCacheEntry e;
+        if (!get_entry(name(output), &e))
+        {
+            // not written by a cached run, trust the timestamps
+            return output_mtime >= input_mtime;
+        }
+
+        return e.options == options && e.input_size == input_size && e.input_mtime == input_mtime && e.output_size == output_size && e.output_mtime == output_mtime;
+    }
+
+    // on a hit the cached output is reflinked or copied to output, true when output is ready
+    bool restore(const std::string &key, const std::filesystem::path &input, const std::filesystem::path &output)
+    {
+        std::string cached;
+        ResultCacheEntry e;
+        {
+            lock.lock();
+            std::map<std::string, std::string>::const_iterator it = keys.find(key);
+            const bool found = it != keys.end();
+            if (found)
+            {
+                cached = it->second;
+                e = entries[cached];
+            }
+            lock.unlock();
+
+            // the file may since have been overwritten from another input
+            if (!found || e.key != key)
+                return false;
+        }
+
+        const std::filesystem::path source = dir / std::filesystem::u8path(cached);
+
+        // the cached file must not have been touched since it was written
+        long long size, mtime;
+        if (!stat(source, &size, &mtime) || size != e.output_size || mtime != e.output_mtime)
+            return false;
+
+        std::error_code ec;
+        if (!std::filesystem::equivalent(source, output, ec))
+        {
+            std::filesystem::create_directories(output.parent_path(), ec);
+            if (!clone_file(source, output))
+                return false;
+        }
+
+        add(key, input, output);
+
+        return true;
+    }
+
+    void add(const std::string &key, const std::filesystem::path &input, const std::filesystem::path &output)
+    {
+        ResultCacheEntry e;
+        e.key = key;
+        e.options = options;
+        if (!stat(input, &e.input_size, &e.input_mtime) || !stat(output, &e.output_size, &e.output_mtime))
+            return;
+
+        const std::string n = name(output);
+
+        lock.lock();
+        if (entries.find(n) != entries.end())
+            dirty = true;
+        set_entry(n, e);
+        if (fp)
+        {
+            write_line(fp, n, e);
+            fflush(fp);
+        }
+        lock.unlock();
+    }
+
+private:
+    static bool stat(const std::filesystem::path &path, long long *size, long long *mtime)
+    {
+        std::error_code ec;
+        const uintmax_t s = std::filesystem::file_size(path, ec);
+        if (ec)
+            return false;
+        const std::filesystem::file_time_type t = std::filesystem::last_write_time(path, ec);
+        if (ec)
+            return false;
+
+        *size = (long long)s;
+        *mtime = (long long)t.time_since_epoch().count();
+        return true;
+    }
+
+    // relative to the index when possible, so the output directory can be moved as a whole
+    std::string name(const std::filesystem::path &output) const
+    {
+        std::error_code ec;
+        const std::filesystem::path relative = std::filesystem::absolute(output, ec).lexically_relative(std::filesystem::absolute(dir, ec));
+        if (relative.empty() || *relative.begin() == "..")
+            return std::filesystem::absolute(output, ec).generic_u8string();
+        return relative.generic_u8string();
+    }
+
+    bool get_entry(const std::string &n, ResultCacheEntry *e)
+    {
+        lock.lock();
+        std::map<std::string, ResultCacheEntry>::const_iterator it = entries.find(n);
+        const bool found = it != entries.end();
+        if (found)
+            *e = it->second;
+        lock.unlock();
+        return found;
+    }
+
+    void set_entry(const std::string &n, const ResultCacheEntry &e)
+    {
+        entries[n] = e;
+        if (!e.key.empty())
+            keys[e.key] = n;
+    }
+
+    static void write_line(FILE *out, const std::string &n, const ResultCacheEntry &e)
+    {
+        fprintf(out, "%s\t%016llx\t%lld\t%lld\t%lld\t%lld\t%s\n", e.key.empty() ? "-" : e.key.c_str(), (unsigned long long)e.options, e.input_size, e.input_mtime, e.output_size, e.output_mtime, n.c_str());
+    }
+
+    std::filesystem::path dir;
+    uint64_t options;
+
+    ncnn::Mutex lock;
+    std::map<std::string, ResultCacheEntry> entries; // by output name
+    std::map<std::string, std::string> keys;         // content key to output name
+    FILE *fp;
+    bool dirty;
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,145 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+// upscaled tiles kept by the content of their padded input, for flat backgrounds and letterboxing
+// shared by every proc thread, oldest tiles are dropped first once the budget is used up
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+// ncnn
+#include "platform.h"
+
+#include "hash.h"
+
+class TileCache
+{
+public:
+    // two independent 64 bit hashes, a false hit would paste a wrong tile
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    TileCache(size_t _max_bytes)
+    {
+        max_bytes = _max_bytes;
+        bytes = 0;
+        lookups = 0;
+        hits = 0;
+    }
+
+    // geometry has everything besides the pixels that shapes the output tile
+    static Key key(const unsigned char *data, size_t stride, size_t rowbytes, int rows, const int *geometry, int geometry_count)
+    {
+        const uint64_t seed = hash64(geometry, geometry_count * sizeof(int), 0);
+        return Key(hash64_rows(data, stride, rowbytes, rows, seed), hash64_rows(data, stride, rowbytes, rows, ~seed));
+    }
+
+    bool get(const Key &k, std::vector<unsigned char> &pixels)
+    {
+        lookups.fetch_add(1, std::memory_order_relaxed);
+
+        lock.lock();
+        std::map<Key, std::vector<unsigned char> >::const_iterator it = tiles.find(k);
+        const bool found = it != tiles.end();
+        if (found)
+            pixels = it->second;
+        lock.unlock();
+
+        if (found)
+            hits.fetch_add(1, std::memory_order_relaxed);
+
+        return found;
+    }
+
+    void put(const Key &k, const std::vector<unsigned char> &pixels)
+    {
+        if (pixels.size() > max_bytes)
+            return;
+
+        lock.lock();
+        if (tiles.find(k) == tiles.end())
+        {
+            while (bytes + pixels.size() > max_bytes && !order.empty())
+            {
+                std::map<Key, std::vector<unsigned char> >::iterator oldest = tiles.find(order.front());
+                bytes -= oldest->second.size();
+                tiles.erase(oldest);
+                order.pop_front();
+            }
+
+            tiles[k] = pixels;
+            order.push_back(k);
+            bytes += pixels.size();
+        }
+        lock.unlock();
+    }
+
+    std::atomic<uint64_t> lookups;
+    std::atomic<uint64_t> hits;
+
+private:
+    size_t max_bytes;
+    size_t bytes;
+
+    ncnn::Mutex lock;
+    std::map<Key, std::vector<unsigned char> > tiles;
+    std::deque<Key> order;
+};
+
+// the tiles of the previous frame by position, for --sequence
+// a tile whose padded input did not change since the previous frame gets the previous output again
+class TileHistory
+{
+public:
+    TileHistory()
+    {
+        xtiles = 0;
+        ytiles = 0;
+        reused = 0;
+        computed = 0;
+    }
+
+    // a frame of another tile layout starts over
+    void begin_frame(int _xtiles, int _ytiles)
+    {
+        if (_xtiles == xtiles && _ytiles == ytiles)
+            return;
+
+        xtiles = _xtiles;
+        ytiles = _ytiles;
+        keys.assign((size_t)xtiles * ytiles, TileCache::Key(0, 0));
+        tiles.assign((size_t)xtiles * ytiles, std::vector<unsigned char>());
+    }
+
+    bool get(int xi, int yi, const TileCache::Key &k, std::vector<unsigned char> &pixels)
+    {
+        const size_t i = (size_t)yi * xtiles + xi;
+        if (tiles[i].empty() || keys[i] != k)
+            return false;
+
+        pixels = tiles[i];
+        reused.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void put(int xi, int yi, const TileCache::Key &k, const std::vector<unsigned char> &pixels)
+    {
+        const size_t i = (size_t)yi * xtiles + xi;
+        keys[i] = k;
+        tiles[i] = pixels;
+    }
+
+    std::atomic<uint64_t> reused;
+    std::atomic<uint64_t> computed; // went through the network
+
+private:
+    int xtiles;
+    int ytiles;
+    std::vector<TileCache::Key> keys;
+    std::vector<std::vector<unsigned char> > tiles;
+};
+
+#endif // TILE_CACHE_H
@@ -0,0 +1,189 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// chrome trace event recorder for --trace, open the output in chrome://tracing or ui.perfetto.dev
+// every thread appends complete events to its own buffer, nothing is recorded while disabled
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "benchmark.h"
+#include "platform.h"
+
+class TraceEvent
+{
+public:
+    const char *name;
+    const char *category;
+    double ts;  // milliseconds
+    double dur; // milliseconds
+};
+
+class TraceThread
+{
+public:
+    int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+};
+
+class Tracer
+{
+public:
+    static bool enabled()
+    {
+        return state().enabled.load(std::memory_order_relaxed);
+    }
+
+    static void enable()
+    {
+        state().enabled.store(true, std::memory_order_relaxed);
+    }
+
+    // lane label shown in the viewer, the first name a thread gets sticks
+    static void set_thread_name(const char *name)
+    {
+        if (!enabled())
+            return;
+
+        TraceThread *thread = current_thread();
+        if (thread->name.empty())
+            thread->name = name;
+    }
+
+    static void add(const char *name, const char *category, double ts, double dur)
+    {
+        if (!enabled())
+            return;
+
+        TraceEvent event;
+        event.name = name;
+        event.category = category;
+        event.ts = ts;
+        event.dur = dur;
+        current_thread()->events.push_back(event);
+    }
+
+    // call once all traced threads are done
+#if _WIN32
+    static int write(const std::wstring &path)
+#else
+    static int write(const std::string &path)
+#endif
+    {
+#if _WIN32
+        FILE *fp = _wfopen(path.c_str(), L"wb");
+#else
+        FILE *fp = fopen(path.c_str(), "wb");
+#endif
+        if (!fp)
+            return -1;
+
+        State &s = state();
+
+        s.lock.lock();
+
+        fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+        bool first = true;
+        for (size_t i = 0; i < s.threads.size(); i++)
+        {
+            const TraceThread *thread = s.threads[i];
+
+            if (!thread->name.empty())
+            {
+                fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}", first ? "" : ",\n", thread->tid, thread->name.c_str(), thread->tid);
+                first = false;
+            }
+
+            for (size_t j = 0; j < thread->events.size(); j++)
+            {
+                const TraceEvent &e = thread->events[j];
+
+                // trace event timestamps are in microseconds
+                fprintf(fp, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", first ? "" : ",\n", e.name, e.category, thread->tid, (e.ts - s.origin) * 1000, e.dur * 1000);
+                first = false;
+            }
+        }
+
+        fprintf(fp, "\n]}\n");
+
+        s.lock.unlock();
+
+        fclose(fp);
+
+        return 0;
+    }
+
+private:
+    class State
+    {
+    public:
+        State()
+        {
+            enabled = false;
+            origin = ncnn::get_current_time();
+        }
+
+        std::atomic<bool> enabled;
+        double origin;
+
+        ncnn::Mutex lock;
+        std::vector<TraceThread *> threads; // kept alive until exit, threads may outlive write()
+    };
+
+    static State &state()
+    {
+        static State s;
+        return s;
+    }
+
+    static TraceThread *current_thread()
+    {
+        static thread_local TraceThread *thread = 0;
+        if (!thread)
+        {
+            State &s = state();
+
+            thread = new TraceThread;
+
+            s.lock.lock();
+            thread->tid = (int)s.threads.size() + 1;
+            s.threads.push_back(thread);
+            s.lock.unlock();
+        }
+
+        return thread;
+    }
+};
+
+// records the enclosing block as one event
+class TraceScope
+{
+public:
+    TraceScope(const char *_name, const char *_category = "host")
+    {
+        name = _name;
+        category = _category;
+        start = Tracer::enabled() ? ncnn::get_current_time() : -1;
+    }
+
+    ~TraceScope()
+    {
+        if (start >= 0)
+            Tracer::add(name, category, start, ncnn::get_current_time() - start);
+    }
+
+private:
+    const char *name;
+    const char *category;
+    double start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...)    TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif // TRACE_H
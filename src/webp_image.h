@@ -47,6 +47,60 @@ unsigned char *webp_load(const unsigned char *buffer, int len, int *w, int *h, i
     return pixeldata;
 }
 
+int webp_get_info(const unsigned char *buffer, int len, int *w, int *h, int *c)
+{
+    WebPBitstreamFeatures features;
+    if (WebPGetFeatures(buffer, len, &features) != VP8_STATUS_OK)
+        return 0;
+
+    *w = features.width;
+    *h = features.height;
+    *c = features.has_alpha ? 4 : 3;
+
+    return 1;
+}
+
+// decode webp incrementally as bytes are read from fp into caller-provided pixeldata
+// header holds the bytes already consumed from fp, stride is the row pitch of pixeldata
+int webp_load_incremental(FILE *fp, const unsigned char *header, int headerlen, unsigned char *pixeldata, int stride, int w, int h, int c)
+{
+    WebPDecoderConfig config;
+    WebPInitDecoderConfig(&config);
+
+#if _WIN32
+    config.output.colorspace = c == 4 ? MODE_BGRA : MODE_BGR;
+#else
+    config.output.colorspace = c == 4 ? MODE_RGBA : MODE_RGB;
+#endif
+
+    config.output.u.RGBA.stride = stride;
+    config.output.u.RGBA.size = (size_t)stride * h;
+    config.output.u.RGBA.rgba = pixeldata;
+    config.output.is_external_memory = 1;
+
+    config.options.use_threads = 1;
+
+    WebPIDecoder *idec = WebPIDecode(NULL, 0, &config);
+    if (!idec)
+        return 0;
+
+    VP8StatusCode status = WebPIAppend(idec, header, headerlen);
+
+    unsigned char chunk[65536];
+    while (status == VP8_STATUS_SUSPENDED)
+    {
+        size_t nread = fread(chunk, 1, sizeof(chunk), fp);
+        if (nread == 0)
+            break;
+
+        status = WebPIAppend(idec, chunk, nread);
+    }
+
+    WebPIDelete(idec);
+
+    return status == VP8_STATUS_OK && config.output.width == w && config.output.height == h;
+}
+
 #if _WIN32
 int webp_save(const wchar_t *filepath, int w, int h, int c, const unsigned char *pixeldata, int quality)
 #else
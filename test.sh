@@ -21,6 +21,22 @@ if [ $TYPE = "file" ]; then
 		ADDITIONAL_ARGS="-i ./images/ -o ./output/ -w 1020 -m models/ -n realesrgan-x4plus -c 0"
 elif [ $TYPE = "folder" ]; then
 		ADDITIONAL_ARGS="-i images/ -o images_out/ -s 4 -m models/ -n realesrgan-x4plus"
+elif [ $TYPE = "pipe" ]; then
+		# 8 synthetic 64x64 rgb24 frames in, 8 frames of 256x256 expected out
+		BYTES=$(head -c $((64 * 64 * 3 * 8)) /dev/urandom | $BIN_PATH --raw 64x64 -i - -o - -m models/ -n realesrgan-x4plus | wc -c)
+		if [ $BYTES -ne $((256 * 256 * 3 * 8)) ]; then
+			echo "pipe: got $BYTES bytes, expected $((256 * 256 * 3 * 8))"
+			exit 1
+		fi
+		# the same as a y4m stream, 4:2:0 frames with their own headers
+		BYTES=$( (printf "YUV4MPEG2 W64 H64 F25:1 Ip A1:1 C420jpeg\n"; for i in 1 2 3 4 5 6 7 8; do printf "FRAME\n"; head -c $((64 * 64 * 3 / 2)) /dev/urandom; done) \
+			| $BIN_PATH --raw y4m -i - -o - -m models/ -n realesrgan-x4plus | wc -c)
+		EXPECTED=$((43 + (6 + 256 * 256 * 3 / 2) * 8))
+		if [ $BYTES -ne $EXPECTED ]; then
+			echo "pipe y4m: got $BYTES bytes, expected $EXPECTED"
+			exit 1
+		fi
+		exit 0
 fi
 
 # Run upscayl-bin